@@ -19,10 +19,20 @@
 
 #include <QString>
 #include <QDebug>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <errno.h>
 
 #ifndef Q_CC_MSVC
 #include <unistd.h>
 #endif
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <dirent.h>
+#endif
 #include "LibUsb.h"
 
 #define LINUX 0
@@ -37,38 +47,81 @@
 #define OperatingSystem 0
 #endif
 
-LibUsb::LibUsb(int type) : type(type)
+#define USB_DEVFS_PATH "/dev/bus/usb"
+
+// Sticks that had their bus reset since they arrived. A stick that is slow
+// to come up is retried every 250ms, resetting it each time would keep it
+// from ever settling. Shared, every stick has a LibUsb of its own.
+static QMutex s_resetMutex;
+static QStringList s_resetSticks;
+
+static bool needsReset(const QString &id)
+{
+    QMutexLocker locker(&s_resetMutex);
+    if (s_resetSticks.contains(id))
+        return false;
+    s_resetSticks.append(id);
+    return true;
+}
+
+LibUsb::LibUsb(int type, bool enumerate) : type(type), enumerate(enumerate)
 {
 
     intf = NULL;
     readBufIndex = 0;
     readBufSize = 0;
 
+    device = NULL;
+    hotplugFd = -1;
+    wakeFd = -1;
+    hotplugCallback = NULL;
+    hotplugUserData = NULL;
+
+    if (!enumerate) return;
+
     // Initialize the library.
     usb_init();
     usb_set_debug(0);
     usb_find_busses();
     usb_find_devices();
+
+}
+
+LibUsb::~LibUsb()
+{
+    close();
+
+#ifdef Q_OS_LINUX
+    if (hotplugFd >= 0) ::close(hotplugFd);
+    if (wakeFd >= 0) ::close(wakeFd);
+#endif
 }
 
 int LibUsb::open()
+{
+    return open(QString());
+}
+
+int LibUsb::open(const QString &stickId)
 {
     // reset counters
     intf = NULL;
     readBufIndex = 0;
     readBufSize = 0;
 
-    // Find all busses.
-    usb_find_busses();
+    if (enumerate) {
+        // Find all busses.
+        usb_find_busses();
 
-    // Find all connected devices.
-    usb_find_devices();
+        // Find all connected devices.
+        usb_find_devices();
+    }
 
     switch (type) {
 
     // Search USB busses for USB2 ANT+ stick host controllers
     default:
-    case TYPE_ANT: device = OpenAntStick();
+    case TYPE_ANT: device = OpenAntStick(stickId);
               break;
     }
 
@@ -81,6 +134,22 @@ int LibUsb::open()
     return 0;
 }
 
+bool LibUsb::isFatalError(int rc)
+{
+    // libusb-0.1 returns -errno, timeouts are part of normal operation
+    switch (-rc) {
+    case ENODEV:
+    case ENOENT:
+    case ESHUTDOWN:
+    case EIO:
+    case EPROTO:
+    case EPIPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
 bool LibUsb::find()
 {
     usb_set_debug(0);
@@ -91,9 +160,145 @@ bool LibUsb::find()
 
     // Search USB busses for USB2 ANT+ stick host controllers
     default:
-    case TYPE_ANT: return findAntStick();
+    case TYPE_ANT: knownSticks = findAntSticks();
               break;
     }
+
+    return !knownSticks.isEmpty();
+}
+
+void LibUsb::setHotplugCallback(HotplugCallback callback, void *userData)
+{
+    hotplugCallback = callback;
+    hotplugUserData = userData;
+
+#ifdef Q_OS_LINUX
+    // Watch the usbfs tree, new bus directories are picked up in handleHotplugEvents()
+    if (hotplugFd < 0) hotplugFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hotplugFd >= 0) {
+        addHotplugWatch(USB_DEVFS_PATH);
+
+        DIR *dir = opendir(USB_DEVFS_PATH);
+        if (dir) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.') continue;
+                addHotplugWatch(QString("%1/%2").arg(USB_DEVFS_PATH).arg(entry->d_name).toLocal8Bit().constData());
+            }
+            closedir(dir);
+        }
+    } else {
+        qDebug() << "inotify_init1 failed, falling back to polling for ANT sticks";
+    }
+
+    if (wakeFd < 0) wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+void LibUsb::wakeHotplug()
+{
+#ifdef Q_OS_LINUX
+    if (wakeFd >= 0) {
+        const uint64_t one = 1;
+        if (::write(wakeFd, &one, sizeof(one)) < 0)
+            qDebug() << "eventfd write failed";
+    }
+#endif
+}
+
+/*
+ * Wait up to timeoutMs (-1 for ever) for usb devices to come or go and report
+ * whether an ANT stick arrived or left. The callback is invoked from here, on
+ * the calling thread. wakeHotplug() cuts the wait short without a bus scan.
+ */
+int LibUsb::handleHotplugEvents(int timeoutMs)
+{
+#ifdef Q_OS_LINUX
+    if (hotplugFd >= 0) {
+        struct pollfd pfd[2];
+        pfd[0].fd = hotplugFd;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = wakeFd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+
+        if (poll(pfd, wakeFd >= 0 ? 2 : 1, timeoutMs) <= 0) return HOTPLUG_NONE;
+
+        if (pfd[1].revents & POLLIN) {
+            uint64_t count;
+            if (::read(wakeFd, &count, sizeof(count)) < 0)
+                qDebug() << "eventfd read failed";
+        }
+
+        if (!(pfd[0].revents & POLLIN)) return HOTPLUG_NONE;
+
+        // Drain the queue, we only care that something changed. A new bus
+        // directory needs a watch of its own though.
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        while ((len = ::read(hotplugFd, buf, sizeof(buf))) > 0) {
+            for (char *ptr = buf; ptr < buf + len; ) {
+                const struct inotify_event *event = (const struct inotify_event *) ptr;
+                if ((event->mask & IN_CREATE) && (event->mask & IN_ISDIR) && event->len)
+                    addHotplugWatch(QString("%1/%2").arg(USB_DEVFS_PATH).arg(event->name).toLocal8Bit().constData());
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        return checkHotplug();
+    }
+#endif
+
+    // No change notification available, poll like we used to
+    if (timeoutMs == 0) return HOTPLUG_NONE;
+    QThread::msleep((timeoutMs < 0 || timeoutMs > 500) ? 500 : timeoutMs);
+
+    return checkHotplug();
+}
+
+int LibUsb::checkHotplug()
+{
+    usb_find_busses();
+    usb_find_devices();
+
+    QStringList sticks = findAntSticks();
+    int event = HOTPLUG_NONE;
+
+    foreach (const QString &id, knownSticks) {
+        if (sticks.contains(id)) continue;
+        event = HOTPLUG_LEFT;
+        if (hotplugCallback) hotplugCallback(event, hotplugUserData);
+    }
+
+    foreach (const QString &id, sticks) {
+        if (knownSticks.contains(id)) continue;
+        event = HOTPLUG_ARRIVED;
+        if (hotplugCallback) hotplugCallback(event, hotplugUserData);
+    }
+
+    knownSticks = sticks;
+
+    // a stick that left gets reset again when it's back
+    {
+        QMutexLocker locker(&s_resetMutex);
+        for (int i = s_resetSticks.size() - 1; i >= 0; --i) {
+            if (!sticks.contains(s_resetSticks[i])) s_resetSticks.removeAt(i);
+        }
+    }
+
+    return event;
+}
+
+void LibUsb::addHotplugWatch(const char *path)
+{
+#ifdef Q_OS_LINUX
+    // IN_ATTRIB as well, udev fixes up permissions after the node is created
+    if (inotify_add_watch(hotplugFd, path, IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+        qDebug() << "inotify_add_watch failed for" << path;
+#else
+    Q_UNUSED(path);
+#endif
 }
 
 void LibUsb::close()
@@ -192,25 +397,26 @@ int LibUsb::write(char *buf, int bytes)
 
 
 
-bool LibUsb::findAntStick()
+QStringList LibUsb::findAntSticks()
 {
     struct usb_bus* bus;
     struct usb_device* dev;
-    bool found = false;
+    QStringList found;
     for (bus = usb_get_busses(); bus; bus = bus->next) {
 
         for (dev = bus->devices; dev; dev = dev->next) {
 
             if (dev->descriptor.idVendor == GARMIN_USB2_VID && 
                 (dev->descriptor.idProduct == GARMIN_USB2_PID || dev->descriptor.idProduct == GARMIN_OEM_PID)) {
-                found = true;
+                found << QString("%1/%2").arg(bus->dirname).arg(dev->filename);
             }
         }
     }
     return found;
 }
 
-struct usb_dev_handle* LibUsb::OpenAntStick()
+// Open the stick with the given "bus/device" id, or the first one found when empty
+struct usb_dev_handle* LibUsb::OpenAntStick(const QString &stickId)
 {
     struct usb_bus* bus;
     struct usb_device* dev;
@@ -225,6 +431,13 @@ struct usb_dev_handle* LibUsb::OpenAntStick()
             if (dev->descriptor.idVendor == GARMIN_USB2_VID &&
                 (dev->descriptor.idProduct == GARMIN_USB2_PID || dev->descriptor.idProduct == GARMIN_OEM_PID)) {
 
+                // leave sticks that other instances have open alone
+                const QString id = QString("%1/%2").arg(bus->dirname).arg(dev->filename);
+                if (!stickId.isEmpty() && stickId != id) continue;
+
+                // once per arrival, not on every retry
+                if (!needsReset(id)) continue;
+
                 if ((udev = usb_open(dev))) {
                     usb_reset(udev);
                     usb_close(udev);
@@ -241,6 +454,8 @@ struct usb_dev_handle* LibUsb::OpenAntStick()
             if (dev->descriptor.idVendor == GARMIN_USB2_VID && 
                 (dev->descriptor.idProduct == GARMIN_USB2_PID || dev->descriptor.idProduct == GARMIN_OEM_PID)) {
 
+                if (!stickId.isEmpty() && stickId != QString("%1/%2").arg(bus->dirname).arg(dev->filename)) continue;
+
                 //Avoid noisy output
                 qDebug() << "Found a Garmin USB2 ANT+ stick" << bus->dirname << " " << dev->filename;
 
@@ -273,6 +488,7 @@ struct usb_dev_handle* LibUsb::OpenAntStick()
                                 if (rc < 0) qDebug()<<"usb_set_altinterface Error: "<< usb_strerror();
                             }
 
+                            openedStickId = QString("%1/%2").arg(bus->dirname).arg(dev->filename);
                             return udev;
                         }
                     }
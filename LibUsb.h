@@ -25,6 +25,9 @@
 #endif
 
 #include <usb.h> // for the constants etc
+#include <QString>
+#include <QStringList>
+#include "anttransport.h"
 
 
 #ifdef WIN32
@@ -37,22 +40,45 @@
 
 #define TYPE_ANT     0
 
+// hotplug events passed to the hotplug callback
+#define HOTPLUG_NONE     0
+#define HOTPLUG_ARRIVED  1
+#define HOTPLUG_LEFT     2
+
+typedef void (*HotplugCallback)(int event, void *userData);
 
 class Context;
 
-class LibUsb {
+class LibUsb : public ANTTransport {
 
 public:
-    LibUsb(int type);
+    // Only one instance should scan the busses, libusb-0.1 keeps a single
+    // global device list and rebuilding it under another thread's open
+    // handles isn't safe. The others, one per stick, open what that scan
+    // found without rescanning.
+    LibUsb(int type, bool enumerate = true);
+    ~LibUsb();
     int open();
+    int open(const QString &stickId); // "bus/device" as returned by findAntSticks()
     void close();
     int read(char *buf, int bytes);
     int write(char *buf, int bytes);
     bool find();
+    static bool isFatalError(int rc); // the stick is gone or needs reopening
+    QStringList findAntSticks(); // from the last bus scan, see find()
+    QString stickId() const {return openedStickId;}
+
+    // Arrival/departure notification for the Garmin VID/PIDs, one event per
+    // stick. On Linux the usbfs device nodes are watched with inotify so the
+    // busses are only rescanned when something was plugged or unplugged,
+    // elsewhere it falls back to rescanning every 500ms. Only set this on
+    // one instance, the per-stick ones don't need the watch.
+    void setHotplugCallback(HotplugCallback callback, void *userData);
+    int handleHotplugEvents(int timeoutMs);
+    void wakeHotplug(); // return from handleHotplugEvents() now, any thread
 private:
 
-    struct usb_dev_handle* OpenAntStick();
-    bool findAntStick();
+    struct usb_dev_handle* OpenAntStick(const QString &stickId);
 
     struct usb_interface_descriptor* usb_find_interface(struct usb_config_descriptor* config_descriptor);
     struct usb_dev_handle* device;
@@ -67,6 +93,16 @@ private:
     int readBufSize;
 
     int type;
+    bool enumerate;
+
+    int checkHotplug();
+    void addHotplugWatch(const char *path);
+    int hotplugFd;
+    int wakeFd;
+    HotplugCallback hotplugCallback;
+    void *hotplugUserData;
+    QStringList knownSticks;
+    QString openedStickId;
 };
 
 #endif // gc_LibUsb_h
@@ -25,6 +25,26 @@ disable-ant-fec {
     DEFINES += DISABLE_ANT_FEC
 }
 
+ant-collector {
+    DEFINES += ANT_COLLECTOR
+}
+
+ant-telemetry {
+    DEFINES += ENABLE_ANT_TELEMETRY
+}
+
+virtual-ant-stick {
+    DEFINES += ANT_VIRTUAL_STICK
+}
+
+disable-tx-planner {
+    DEFINES += DISABLE_TX_PLANNER
+}
+
+disable-tx-coalescing {
+    DEFINES += DISABLE_TX_COALESCING
+}
+
 raspberry-pi {
     DEFINES += RASPBERRYPI
 }
@@ -38,7 +58,25 @@ SOURCES +=  main.cpp \
             ant.cpp \
             fecdevice.cpp \
             antdevice.cpp \
-            btcyclingpowerservice.cpp
+            btcyclingpowerservice.cpp \
+            collectordevice.cpp \
+            telemetrydevice.cpp \
+            transmitplanner.cpp \
+            pagescheduler.cpp \
+            antstick.cpp \
+            virtualstick.cpp \
+            antlinkstats.cpp \
+            rfsurvey.cpp \
+            txpowercontroller.cpp \
+            antmux.cpp \
+            antmuxclient.cpp \
+            antcapture.cpp \
+            capturetransport.cpp \
+            controllatency.cpp \
+            fecsimulation.cpp \
+            channelconfig.cpp \
+            anttransmitter.cpp \
+            anttrace.cpp
 
 HEADERS  += mainwindow.h \
             MonarkConnection.h \
@@ -48,4 +86,24 @@ HEADERS  += mainwindow.h \
             ant.h \
             fecdevice.h \
             antdevice.h \
-            btcyclingpowerservice.h
+            btcyclingpowerservice.h \
+            collectordevice.h \
+            telemetrydevice.h \
+            transmitplanner.h \
+            pagescheduler.h \
+            antstick.h \
+            anttransport.h \
+            virtualstick.h \
+            antlinkstats.h \
+            rfsurvey.h \
+            txpowercontroller.h \
+            antmux.h \
+            antmuxclient.h \
+            antcapture.h \
+            capturetransport.h \
+            controllatency.h \
+            fecsimulation.h \
+            channelconfig.h \
+            antprofile.h \
+            anttransmitter.h \
+            anttrace.h
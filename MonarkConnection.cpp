@@ -48,7 +48,9 @@ void MonarkConnection::setPollInterval(int interval)
     if (interval != m_pollInterval)
     {
         m_pollInterval = interval;
-        m_timer->setInterval(m_pollInterval);
+        // the timer is created in run(), it picks the interval up when started
+        if (m_timer)
+            m_timer->setInterval(m_pollInterval);
     }
 }
 
@@ -114,8 +116,15 @@ void MonarkConnection::requestAll()
     requestPulse();
     requestCadence();
 
-    if ((m_loadToWrite != m_load) && m_canControlPower)
+    if (m_shouldWriteLoad && (m_loadToWrite == m_load) && m_canControlPower)
     {
+        // asked for the load it already has
+        m_shouldWriteLoad = false;
+        emit loadWritten(m_load);
+    }
+    else if ((m_loadToWrite != m_load) && m_canControlPower)
+    {
+        m_shouldWriteLoad = false;
         QString cmd = QString("power %1\r").arg(m_loadToWrite);
         m_serial->write(cmd.toStdString().c_str());
         if (!m_serial->waitForBytesWritten(500))
@@ -124,6 +133,10 @@ void MonarkConnection::requestAll()
             emit connectionStatus(false);
             m_startupTimer->start();
         }
+        else
+        {
+            emit loadWritten(m_loadToWrite);
+        }
         m_load = m_loadToWrite;
         QByteArray data = m_serial->readAll();
     }
@@ -221,6 +234,8 @@ void MonarkConnection::identifyModel()
         m_canControlPower = true;
         setLoad(100);
     }
+
+    emit controlSupported(m_canControlPower);
 }
 
 void MonarkConnection::setLoad(unsigned int load)
@@ -346,7 +361,7 @@ void MonarkConnection::identifySerialPort()
 
     identifyModel();
 
-    m_timer->setInterval(1000);
+    m_timer->setInterval(m_pollInterval);
     m_timer->start();
 
     emit connectionStatus(true);
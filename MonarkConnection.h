@@ -67,6 +67,8 @@ signals:
     void cadence(quint8);
     void power(quint16);
     void connectionStatus(bool connected);
+    void loadWritten(quint32 load); // the bike has been sent the new load
+    void controlSupported(bool supported); // whether the bike takes a load at all
 };
 
 #endif // _GC_MonarkConnection_h
@@ -20,217 +20,366 @@
 
 #include "ant.h"
 #include <QDebug>
-#include "antmessage.h"
+#include <QMutexLocker>
+#include "powerdevice.h"
+#include "fecdevice.h"
+#include "collectordevice.h"
+#include "telemetrydevice.h"
+#include "anttrace.h"
+#include "virtualstick.h"
+#include "antmuxclient.h"
+#include "capturetransport.h"
+
+// how often a stick that is plugged in but fails to open is retried
+#define ANT_REOPEN_RETRY_MS 250
 
 ANT::ANT(unsigned short deviceId) :
     m_usb(0),
-    m_state(ST_WAIT_FOR_SYNC),
-    m_deviceId(deviceId)
+    m_capture(0),
+    m_deviceId(deviceId),
+    m_fecController(false)
 {
-
-}
-
-void ANT::run()
-{
-
-    m_usb = new LibUsb(TYPE_ANT);
+#ifdef ANT_COLLECTOR
+    // Continuous scan occupies the whole radio, so no transmitting channels in this mode
+    m_profiles << ProfileCollector;
+#else
 #ifndef DISABLE_ANT_POWER
-    m_devices[1] = new PowerDevice(m_usb,1, m_deviceId);
+    m_profiles << ProfilePower;
 #endif
 #ifndef DISABLE_ANT_FEC
-    m_devices[2] = new FECDevice(m_usb,2, m_deviceId);
-    FECDevice * fecDevice = static_cast<FECDevice*>(m_devices[2]);
-    connect(fecDevice, SIGNAL(newTargetPower(quint32)), this, SIGNAL(newTargetPower(quint32)));
+    m_profiles << ProfileFEC;
+#endif
+#ifdef ENABLE_ANT_TELEMETRY
+    m_profiles << ProfileTelemetry;
+#endif
 #endif
+}
+
+void ANT::run()
+{
+    ANTTrace::init();
 
     qDebug() << "Starting ANT thread";
-    while (!m_usb->find())
+
+    const QByteArray capture = qgetenv("ANT_CAPTURE");
+    if (!capture.isEmpty())
     {
-        msleep(500);
+        m_capture = new ANTCaptureWriter;
+        if (!m_capture->open(QString::fromLocal8Bit(capture)))
+        {
+            delete m_capture;
+            m_capture = 0;
+        }
     }
 
-    qDebug() << "Open stick? " << m_usb->open();
+    // what a stick said in a capture, as fast as it can be parsed
+    const QByteArray replay = qgetenv("ANT_REPLAY");
+    if (!replay.isEmpty())
+    {
+        // the stick thread parses it, nothing else to do here
+        openStick("replay", new ReplayTransport(QString::fromLocal8Bit(replay)));
+        return;
+    }
 
-    const unsigned char key[8] = { 0xB9, 0xA5, 0x21, 0xFB, 0xBD, 0x72, 0xC3, 0x45 };
+    // another instance owns the stick and shares it
+    const QByteArray mux = qgetenv("ANT_MUX");
+    if (!mux.isEmpty())
+    {
+        runMuxClient(QString::fromLocal8Bit(mux));
+        return;
+    }
 
-    // Set ANT+ network key for network 0
-    ANTMessage mess(9, ANT_SET_NETWORK, 0, key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7]);
-    m_usb->write((char *)mess.data,mess.length);
+#ifdef ANT_VIRTUAL_STICK
+    // software sticks instead of usb, ANT_VIRTUAL_STICKS of them
+    bool ok = false;
+    int count = qgetenv("ANT_VIRTUAL_STICKS").toInt(&ok);
+    if (!ok || count < 1)
+        count = 1;
 
-    msleep(100);
+    for (int i = 0; i < count; ++i)
+        openStick(QString("virtual/%1").arg(i), new VirtualStick);
+
+    // nothing gets plugged or unplugged, the sticks carry on in their own threads
+    return;
+#endif
 
-    foreach (ANTDevice* antdev, m_devices)
+    m_usb = new LibUsb(TYPE_ANT);
+
+    m_usb->setHotplugCallback(&ANT::hotplugEvent, this);
+    m_usb->find();
+
+    while (1)
     {
-        antdev->configureChannel();
+        // Wakes up when the usb device nodes change or a stick loses its
+        // link without being unplugged, no periodic bus scan. Only a stick
+        // that is there but won't open is retried on a timer.
+        const bool opened = openNewSticks();
+        m_usb->handleHotplugEvents(opened ? -1 : ANT_REOPEN_RETRY_MS);
     }
+}
+
+void ANT::runMuxClient(const QString &socketPath)
+{
+    ANTMuxClient *transport = new ANTMuxClient;
 
-    while(1)
+    // the multiplexer may not be up yet
+    while (transport->open(socketPath) < 0)
+        msleep(1000);
+    transport->close();
+
+    openStick(socketPath, transport);
+
+    // the multiplexer restarting or losing its stick looks like an unplug,
+    // sleep until the stick says so and then until the multiplexer is back
+    while (1)
     {
-        // read more bytes from the device
-        uint8_t byte;
-        if (m_usb->read((char *)&byte, 1) > 0) receiveByte((unsigned char)byte);
-        else msleep(5);
+        m_stickLost.acquire();
+
+        for (;;)
+        {
+            QList<ANTStick*> sticks;
+            {
+                QMutexLocker locker(&m_sticksMutex);
+                sticks = m_sticks;
+            }
+
+            bool lost = false;
+            foreach (ANTStick *stick, sticks)
+            {
+                if (!stick->isLost())
+                    continue;
+
+                if (stick->reattach(socketPath))
+                    qDebug() << "ANT: reconnected to" << socketPath;
+                else
+                    lost = true;
+            }
+
+            if (!lost)
+                break;
+
+            msleep(1000);
+        }
     }
 }
 
-void ANT::receiveByte(unsigned char byte) {
+void ANT::hotplugEvent(int event, void *userData)
+{
+    Q_UNUSED(userData);
+    qDebug() << "ANT stick" << (event == HOTPLUG_ARRIVED ? "arrived" : "left");
+}
 
-    switch (m_state) {
-    case ST_WAIT_FOR_SYNC:
-        if (byte == ANT_SYNC_BYTE) {
-            m_state = ST_GET_LENGTH;
-            checksum = ANT_SYNC_BYTE;
-            rxMessage[0] = byte;
-        }
-        break;
+void ANT::stickLost()
+{
+    // called on the stick's thread
+    if (m_usb)
+        m_usb->wakeHotplug();
+    else
+        m_stickLost.release();
+}
 
-    case ST_GET_LENGTH:
-        if ((byte == 0) || (byte > ANT_MAX_LENGTH)) {
-            m_state = ST_WAIT_FOR_SYNC;
-        }
-        else {
-            rxMessage[ANT_OFFSET_LENGTH] = byte;
-            checksum ^= byte;
-            length = byte;
-            bytes = 0;
-            m_state = ST_GET_MESSAGE_ID;
+bool ANT::openNewSticks()
+{
+    bool opened = true;
+
+    const QStringList ids = m_usb->findAntSticks();
+
+    // unplugged sticks might not notice until their next read times out
+    foreach (ANTStick *stick, m_sticks)
+    {
+        if (!stick->isLost() && !ids.contains(stick->id()))
+            stick->markLost();
+    }
+
+    // A stick being torn down is as good as lost, but it can't be reattached
+    // until its thread is done. Its linkLost() brings us back here.
+    bool teardownPending = false;
+    foreach (ANTStick *stick, m_sticks)
+    {
+        if (stick->teardownPending())
+            teardownPending = true;
+    }
+
+    foreach (const QString &id, ids)
+    {
+        bool known = false;
+        foreach (ANTStick *stick, m_sticks)
+        {
+            if (!stick->isLost() && !stick->teardownPending() && stick->id() == id)
+                known = true;
         }
-        break;
-
-    case ST_GET_MESSAGE_ID:
-        rxMessage[ANT_OFFSET_ID] = byte;
-        checksum ^= byte;
-        m_state = ST_GET_DATA;
-        break;
-
-    case ST_GET_DATA:
-        rxMessage[ANT_OFFSET_DATA + bytes] = byte;
-        checksum ^= byte;
-        if (++bytes >= length){
-            m_state = ST_VALIDATE_PACKET;
+
+        if (known)
+            continue;
+
+        // might be the stick that is on its way out, replugged already
+        if (teardownPending)
+        {
+            opened = false;
+            continue;
         }
-        break;
 
-    case ST_VALIDATE_PACKET:
-        if (checksum == byte){
-            processMessage();
+        // a stick coming back, or replugged into another port, takes over
+        // from a lost one before counting as new
+        bool reattached = false;
+        foreach (ANTStick *stick, m_sticks)
+        {
+            if (stick->isLost() && stick->reattach(id))
+            {
+                qDebug() << "ANT: reattached stick" << stick->index() << "as" << id;
+                reattached = true;
+                break;
+            }
         }
-        m_state = ST_WAIT_FOR_SYNC;
-        break;
+
+        if (reattached)
+            continue;
+
+        if (!openStick(id, 0))
+            opened = false;
     }
+
+    return opened;
 }
 
-void ANT::processMessage()
+bool ANT::openStick(const QString &id, ANTTransport *transport)
 {
+    if (m_capture)
+        transport = new CaptureTransport(transport ? transport : new LibUsb(TYPE_ANT, false), m_capture, m_sticks.size());
+    else if (!transport)
+        transport = new LibUsb(TYPE_ANT, false);
 
-    fprintf(stderr, "Recv: ");
-    for (int i=0; i<=rxMessage[ANT_OFFSET_LENGTH]; ++i)
-    {
-        fprintf(stderr, "[%02x]", rxMessage[ANT_OFFSET_DATA+i]);
-    }
-
-   fprintf(stderr, "\n");
-
-    switch (rxMessage[ANT_OFFSET_ID]) {
-    case ANT_NOTIF_STARTUP:
-        break;
-    case ANT_ACK_DATA:
-    case ANT_BROADCAST_DATA:
-    case ANT_CHANNEL_STATUS:
-    case ANT_CHANNEL_ID:
-    case ANT_BURST_DATA:
-        handleChannelEvent();
-        break;
-
-    case ANT_CHANNEL_EVENT:
-        switch (rxMessage[ANT_OFFSET_MESSAGE_CODE]) {
-        case EVENT_TRANSFER_TX_FAILED:
-            break;
-        case EVENT_TRANSFER_TX_COMPLETED:
-            // fall through
-        default:
-            handleChannelEvent();
-        }
-        break;
+    ANTStick *stick = new ANTStick(id, m_sticks.size(), transport);
+    if (!stick->open())
+    {
+        delete stick;
+        return false;
+    }
 
-    case ANT_VERSION:
-        break;
+    connect(stick, &ANTStick::linkLost, this, &ANT::stickLost, Qt::DirectConnection);
 
-    case ANT_CAPABILITIES:
-        break;
+    qDebug() << "ANT: opened stick" << id << "with" << stick->maxChannels() << "channels";
 
-    case ANT_SERIAL_NUMBER:
-        break;
+    placeProfiles(stick);
 
-    default:
-        break;
+    {
+        QMutexLocker locker(&m_sticksMutex);
+        m_sticks.append(stick);
     }
+
+    stick->start();
+    return true;
 }
 
-//
-// Pass inbound message to channel for handling
-//
-void ANT::handleChannelEvent(void) {
-    int channels = 8; // depending on stick, mine is 8 channels
-    int channel = rxMessage[ANT_OFFSET_DATA] & 0x7;
-    if(channel >= 0 && channel < channels) {
+void ANT::placeProfiles(ANTStick *stick)
+{
+    foreach (Profile profile, m_profiles)
+    {
+        // one scanner and one telemetry stream is enough, more would
+        // report every sample twice
+        if ((profile == ProfileCollector || profile == ProfileTelemetry) && stick->index() > 0)
+            continue;
 
-        // handle a channel event here!
-        //antChannel[channel]->receiveMessage(rxMessage);
-        //qDebug() << "Channel event on channel: " << channel;
-        receiveChannelMessage(rxMessage);
+        if (!createDevice(profile, stick))
+            qDebug() << "ANT: no free channel for profile" << profile << "on stick" << stick->index();
     }
 }
 
-
-void ANT::receiveChannelMessage(unsigned char *ant_message)
+bool ANT::createDevice(Profile profile, ANTStick *stick)
 {
-    switch (ant_message[2]) {
-    case ANT_CHANNEL_EVENT:
-        if (m_devices.contains(ant_message[3]))
+    int channel;
+
+    // 0 is the wildcard a display searches with, never transmit under it
+    const unsigned short deviceId = m_deviceId ? m_deviceId : 1;
+
+    // The stick index goes in the upper nibble of the transmission type,
+    // which keeps the 16 bit number clear of neighbouring bridges
+    if (stick->index() > 0x0F)
+        return false;
+
+    switch (profile)
+    {
+    case ProfileCollector:
+    {
+        CollectorDevice * collector = new CollectorDevice(stick->transmitter(), 0);
+        connect(collector, SIGNAL(sampleReceived(unsigned short,unsigned char,quint16,quint8)),
+                this, SIGNAL(collectedSample(unsigned short,unsigned char,quint16,quint8)));
+        stick->addDevice(0, collector);
+        return true;
+    }
+    case ProfilePower:
+    {
+        if ((channel = stick->allocateChannel()) < 0)
+            return false;
+        PowerDevice * powerDevice = new PowerDevice(stick->transmitter(), channel, deviceId);
+        powerDevice->setDeviceNumberExtension(stick->index());
+        stick->addDevice(channel, powerDevice);
+        return true;
+    }
+    case ProfileFEC:
+    {
+        if ((channel = stick->allocateChannel()) < 0)
+            return false;
+        FECDevice * fecDevice = new FECDevice(stick->transmitter(), channel, deviceId);
+        fecDevice->setDeviceNumberExtension(stick->index());
+
+        // There is one bike, so the first FE-C channel is the only one that
+        // sets its load. The copies on other sticks broadcast the same data.
+        if (!m_fecController)
         {
-            m_devices[ant_message[3]]->channelEvent(ant_message);
+            connect(fecDevice, SIGNAL(newTargetPower(quint32)), this, SIGNAL(newTargetPower(quint32)));
+            m_fecController = true;
         }
-        break;
-    case ANT_BROADCAST_DATA:
-        //broadcastEvent(ant_message);
-        qDebug()<<"Channel broadcast event:";
-        break;
-    case ANT_ACK_DATA:
-        //ackEvent(ant_message);
-        qDebug()<<"Channel ack data";
-        if (m_devices.contains(ant_message[3]))
+        else
+            fecDevice->setControllable(false);
+
+        stick->addDevice(channel, fecDevice);
+        return true;
+    }
+    case ProfileTelemetry:
+    {
+        unsigned char key[ANT_KEY_LENGTH];
+        if (!TelemetryDevice::networkKey(key))
         {
-            m_devices[ant_message[3]]->handleAckData(ant_message);
+            // left out on purpose, not for want of a channel
+            qDebug() << "ANT: ANT_TELEMETRY_KEY not set, no telemetry channel";
+            return true;
         }
-
-        break;
-    case ANT_CHANNEL_ID:
-        //channelId(ant_message);
-        qDebug()<<"Channel id";
-        break;
-    case ANT_BURST_DATA:
-        //burstData(ant_message);
-        qDebug() << "Channel burst data";
-        break;
-    default:
-        //qDebug()<<"dunno?"<<number;
-        break; //errors silently ignored for now, would indicate hardware fault.
+        if (TELEMETRY_NETWORK >= stick->maxNetworks() || (channel = stick->allocateChannel()) < 0)
+            return false;
+        stick->addDevice(channel, new TelemetryDevice(stick->transmitter(), channel, deviceId));
+        return true;
     }
+    }
+
+    return false;
+}
+
+QList<ANTLinkStats::Snapshot> ANT::linkStats()
+{
+    QMutexLocker locker(&m_sticksMutex);
+
+    QList<ANTLinkStats::Snapshot> stats;
+    foreach (ANTStick *stick, m_sticks)
+        stats << stick->linkStats();
+
+    return stats;
 }
 
 void ANT::setCurrentPower(quint16 power)
 {
-    foreach (ANTDevice* antdev, m_devices)
+    QMutexLocker locker(&m_sticksMutex);
+    foreach (ANTStick *stick, m_sticks)
     {
-        antdev->setCurrentPower(power);
+        stick->setCurrentPower(power);
     }
 }
 
 void ANT::setCurrentCadence(quint8 cadence)
 {
-    foreach (ANTDevice* antdev, m_devices)
+    QMutexLocker locker(&m_sticksMutex);
+    foreach (ANTStick *stick, m_sticks)
     {
-        antdev->setCurrentCadence(cadence);
+        stick->setCurrentCadence(cadence);
     }
 }
@@ -22,45 +22,65 @@
 #define ANT_H
 
 #include <QThread>
+#include <QList>
+#include <QMutex>
+#include <QSemaphore>
 #include "LibUsb.h"
-#include "antmessage.h"
-
-#include "powerdevice.h"
-#include "fecdevice.h"
-#include <QMap>
+#include "antstick.h"
+#include "antcapture.h"
 
+/*
+ * Finds the ANT sticks on the host and opens each in its own ANTStick. The
+ * busses are only scanned here, each stick is handed the device that scan
+ * found. Every stick carries the power and FE-C profiles for the same bike,
+ * with the stick index in the upper nibble of the transmission type so each
+ * copy has a 20 bit device number of its own, and more sticks means more head
+ * units that can pair. Only the first FE-C channel controls the bike, the
+ * copies broadcast and turn control pages down. The collector and telemetry
+ * stay on the first stick, a second one would report every sample twice.
+ *
+ * With ANT_MUX set the stick belongs to another process running ANTMux,
+ * and the profiles go on the channels it shares with us instead.
+ *
+ * ANT_CAPTURE=<file> records every frame to and from the sticks, and
+ * ANT_REPLAY=<file> runs a capture through a stick instead of using usb.
+ */
 class ANT : public QThread
 {
     Q_OBJECT
 public:
     ANT(unsigned short deviceId);
 
+    QList<ANTLinkStats::Snapshot> linkStats(); // one per stick, in stick index order
+
 public slots:
     void setCurrentPower(quint16 power);
     void setCurrentCadence(quint8 cadence);
 
 private:
-    void run();
-    LibUsb *m_usb;
-    //PowerDevice *m_pd;
-    QMap<int, ANTDevice*> m_devices;
+    enum Profile {ProfileCollector, ProfilePower, ProfileFEC, ProfileTelemetry};
 
-    // state machine whilst receiving bytes
-    enum States {ST_WAIT_FOR_SYNC, ST_GET_LENGTH, ST_GET_MESSAGE_ID, ST_GET_DATA, ST_VALIDATE_PACKET} m_state;
-    void receiveByte(unsigned char byte);
-    void processMessage();
-    void handleChannelEvent();
-    void receiveChannelMessage(unsigned char *ant_message);
-
-    unsigned char rxMessage[ANT_MAX_MESSAGE_SIZE];
+    void run();
+    void runMuxClient(const QString &socketPath);
+    static void hotplugEvent(int event, void *userData);
+    void stickLost();
+    bool openNewSticks(); // false when a stick that's plugged in didn't open
+    bool openStick(const QString &id, ANTTransport *transport);
+    void placeProfiles(ANTStick *stick);
+    bool createDevice(Profile profile, ANTStick *stick);
 
-    int length;
-    int bytes;
-    int checksum;
+    LibUsb *m_usb; // enumeration and hotplug only, each stick has its own that doesn't scan
+    ANTCaptureWriter *m_capture; // ANT_CAPTURE, 0 when not capturing
+    QList<ANTStick*> m_sticks;
+    QMutex m_sticksMutex; // the slots walk m_sticks from the caller's thread
+    QSemaphore m_stickLost; // a mux client stick lost its link
+    QList<Profile> m_profiles; // placed on every stick
     unsigned short m_deviceId;
+    bool m_fecController; // an FE-C channel already controls the bike
 
 signals:
     void newTargetPower(quint32 targetPower);
+    void collectedSample(unsigned short deviceNumber, unsigned char deviceType, quint16 power, quint8 cadence);
 
 };
 
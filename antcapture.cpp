@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "antcapture.h"
+#include <QDebug>
+#include <QDateTime>
+#include <QMutexLocker>
+
+static void putLE(unsigned char *p, quint64 value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static quint64 getLE(const unsigned char *p, int bytes)
+{
+    quint64 value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value |= quint64(p[i]) << (8 * i);
+    return value;
+}
+
+static unsigned char channelOf(const unsigned char *frame)
+{
+    switch (frame[ANT_OFFSET_ID])
+    {
+    case ANT_BROADCAST_DATA:
+    case ANT_ACK_DATA:
+    case ANT_BURST_DATA:
+    case ANT_CHANNEL_EVENT:
+    case ANT_CHANNEL_STATUS:
+    case ANT_CHANNEL_ID:
+    case ANT_ASSIGN_CHANNEL:
+    case ANT_UNASSIGN_CHANNEL:
+    case ANT_CHANNEL_PERIOD:
+    case ANT_CHANNEL_FREQUENCY:
+    case ANT_CHANNEL_TX_POWER:
+    case ANT_OPEN_CHANNEL:
+    case ANT_CLOSE_CHANNEL:
+        return frame[ANT_OFFSET_CHANNEL_NUMBER] & ANT_CHANNEL_NUMBER_MASK;
+    default:
+        return ANT_CAPTURE_NO_CHANNEL;
+    }
+}
+
+ANTCaptureWriter::ANTCaptureWriter() :
+    m_offset(0),
+    m_records(0)
+{
+}
+
+ANTCaptureWriter::~ANTCaptureWriter()
+{
+    QMutexLocker locker(&m_mutex);
+    m_file.close();
+    m_index.close();
+}
+
+bool ANTCaptureWriter::open(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_file.setFileName(path);
+    m_index.setFileName(path + ".idx");
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate) || !m_index.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "ANTCaptureWriter: can't write" << path << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    unsigned char header[ANT_CAPTURE_HEADER_SIZE];
+    memcpy(header, ANT_CAPTURE_MAGIC, 4);
+    putLE(header + 4, ANT_CAPTURE_VERSION, 2);
+    putLE(header + 6, 0, 2);
+    putLE(header + 8, QDateTime::currentMSecsSinceEpoch(), 8);
+    m_file.write((const char *)header, sizeof(header));
+
+    m_offset = sizeof(header);
+    m_records = 0;
+    m_clock.start();
+
+    qDebug() << "ANTCaptureWriter: capturing to" << path;
+    return true;
+}
+
+void ANTCaptureWriter::record(ANTCaptureRecord::Direction direction, int stick, const unsigned char *frame)
+{
+    const int length = frame[ANT_OFFSET_LENGTH] + 4;
+    if (length > ANT_MAX_MESSAGE_SIZE)
+        return;
+
+    unsigned char record[ANT_CAPTURE_RECORD_HEADER + ANT_MAX_MESSAGE_SIZE];
+    record[8] = direction;
+    record[9] = stick;
+    record[10] = channelOf(frame);
+    record[11] = length;
+    memcpy(record + ANT_CAPTURE_RECORD_HEADER, frame, length);
+
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_file.isOpen())
+        return;
+
+    // stamped under the lock so the file stays in time order
+    const qint64 timestamp = m_clock.nsecsElapsed();
+    putLE(record, timestamp, 8);
+
+    if (m_records++ % ANT_CAPTURE_INDEX_INTERVAL == 0)
+    {
+        unsigned char entry[16];
+        putLE(entry, timestamp, 8);
+        putLE(entry + 8, m_offset, 8);
+        m_index.write((const char *)entry, sizeof(entry));
+
+        // what's on disk stays readable if we go down
+        m_file.flush();
+        m_index.flush();
+    }
+
+    m_file.write((const char *)record, ANT_CAPTURE_RECORD_HEADER + length);
+    m_offset += ANT_CAPTURE_RECORD_HEADER + length;
+}
+
+ANTCaptureReader::ANTCaptureReader() :
+    m_startTime(0)
+{
+}
+
+bool ANTCaptureReader::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "ANTCaptureReader: can't read" << path << m_file.errorString();
+        return false;
+    }
+
+    unsigned char header[ANT_CAPTURE_HEADER_SIZE];
+    if (m_file.read((char *)header, sizeof(header)) != sizeof(header) || memcmp(header, ANT_CAPTURE_MAGIC, 4) != 0
+            || getLE(header + 4, 2) != ANT_CAPTURE_VERSION)
+    {
+        qDebug() << "ANTCaptureReader:" << path << "is not a version" << ANT_CAPTURE_VERSION << "capture";
+        m_file.close();
+        return false;
+    }
+
+    m_startTime = getLE(header + 8, 8);
+
+    // seeking works without the index, just slower
+    m_index.clear();
+    QFile index(path + ".idx");
+    if (index.open(QIODevice::ReadOnly))
+    {
+        unsigned char entry[16];
+        while (index.read((char *)entry, sizeof(entry)) == sizeof(entry))
+        {
+            IndexEntry e;
+            e.timestamp = getLE(entry, 8);
+            e.offset = getLE(entry + 8, 8);
+            m_index.append(e);
+        }
+    }
+
+    return true;
+}
+
+bool ANTCaptureReader::next(ANTCaptureRecord &record)
+{
+    unsigned char header[ANT_CAPTURE_RECORD_HEADER];
+    if (m_file.read((char *)header, sizeof(header)) != sizeof(header))
+        return false;
+
+    record.timestamp = getLE(header, 8);
+    record.direction = header[8];
+    record.stick = header[9];
+    record.channel = header[10];
+    record.length = header[11];
+
+    // a record cut short by a crash ends the capture
+    if (record.length > ANT_MAX_MESSAGE_SIZE || m_file.read((char *)record.frame, record.length) != record.length)
+        return false;
+
+    return true;
+}
+
+bool ANTCaptureReader::seek(qint64 timestamp)
+{
+    // last indexed record before the timestamp, then read forward from there
+    qint64 offset = ANT_CAPTURE_HEADER_SIZE;
+    int lo = 0, hi = m_index.size();
+    while (lo < hi)
+    {
+        const int mid = (lo + hi) / 2;
+        if (m_index[mid].timestamp < timestamp)
+        {
+            offset = m_index[mid].offset;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (!m_file.seek(offset))
+        return false;
+
+    ANTCaptureRecord record;
+    qint64 position = offset;
+    while (next(record))
+    {
+        if (record.timestamp >= timestamp)
+            return m_file.seek(position);
+        position += ANT_CAPTURE_RECORD_HEADER + record.length;
+    }
+
+    return false;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef ANTCAPTURE_H
+#define ANTCAPTURE_H
+
+#include <QFile>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+#include "antmessage.h"
+
+#define ANT_CAPTURE_MAGIC          "ANTC"
+#define ANT_CAPTURE_VERSION        1
+#define ANT_CAPTURE_HEADER_SIZE    16
+#define ANT_CAPTURE_RECORD_HEADER  12
+#define ANT_CAPTURE_INDEX_INTERVAL 256 // records between index entries
+#define ANT_CAPTURE_NO_CHANNEL     0xFF
+
+/*
+ * Append-only capture of the frames going to and from the sticks, for bug
+ * reports and for replaying real traffic through the parser. All numbers
+ * are little endian.
+ *
+ * file header  "ANTC", version (2), flags (2), start time (8, ms since the epoch)
+ * record       timestamp (8, ns since the start), direction (1, 0 rx 1 tx),
+ *              stick (1), channel (1, 0xFF if the frame has none), length (1),
+ *              frame (length, sync to checksum)
+ *
+ * Next to it, <file>.idx holds a timestamp (8) and file offset (8) for
+ * every ANT_CAPTURE_INDEX_INTERVAL-th record so a reader can seek without
+ * scanning the whole capture.
+ */
+struct ANTCaptureRecord
+{
+    enum Direction {Rx, Tx};
+
+    qint64 timestamp; // ns since the capture started
+    unsigned char direction;
+    unsigned char stick;
+    unsigned char channel;
+    unsigned char length;
+    unsigned char frame[ANT_MAX_MESSAGE_SIZE];
+};
+
+class ANTCaptureWriter
+{
+public:
+    ANTCaptureWriter();
+    ~ANTCaptureWriter();
+
+    bool open(const QString &path); // truncates an existing capture
+
+    // frame is a whole frame, sync to checksum, from any thread
+    void record(ANTCaptureRecord::Direction direction, int stick, const unsigned char *frame);
+
+private:
+    QMutex m_mutex;
+    QFile m_file;
+    QFile m_index;
+    QElapsedTimer m_clock;
+    qint64 m_offset;
+    qint64 m_records;
+};
+
+class ANTCaptureReader
+{
+public:
+    ANTCaptureReader();
+
+    bool open(const QString &path);
+
+    qint64 startTime() const {return m_startTime;}
+
+    bool next(ANTCaptureRecord &record); // false at the end of the capture
+    bool seek(qint64 timestamp); // to the first record at or after timestamp
+
+private:
+    struct IndexEntry {
+        qint64 timestamp;
+        qint64 offset;
+    };
+
+    QFile m_file;
+    qint64 m_startTime;
+    QVector<IndexEntry> m_index;
+};
+
+#endif // ANTCAPTURE_H
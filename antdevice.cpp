@@ -17,7 +17,44 @@
  */
 
 #include "antdevice.h"
+#include "antmessage.h"
 
 ANTDevice::ANTDevice()
 {
 }
+
+void ANTDevice::handleBroadcastData(unsigned char *ant_message)
+{
+    // Transmitting profiles have no use for broadcasts
+    Q_UNUSED(ant_message);
+}
+
+unsigned short ANTDevice::channelPeriod() const
+{
+    return 0;
+}
+
+void ANTDevice::setChannelPeriod(unsigned short period)
+{
+    Q_UNUSED(period);
+}
+
+bool ANTDevice::fixedChannelPeriod() const
+{
+    return true;
+}
+
+unsigned char ANTDevice::channelFrequency() const
+{
+    return ANT_SPORT_FREQUENCY;
+}
+
+void ANTDevice::setChannelFrequency(unsigned char frequency)
+{
+    Q_UNUSED(frequency);
+}
+
+bool ANTDevice::fixedChannelFrequency() const
+{
+    return true;
+}
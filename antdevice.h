@@ -28,9 +28,20 @@ public:
     virtual int channel() const = 0;
     virtual void channelEvent(unsigned char *ant_message) = 0;
     virtual void handleAckData(unsigned char *ant_message) = 0;
+    virtual void handleBroadcastData(unsigned char *ant_message);
     virtual void configureChannel() = 0;
     virtual void setCurrentPower(quint16 power) = 0;
     virtual void setCurrentCadence(quint8 cadence) = 0;
+
+    // Channel period in 1/32768s, 0 for channels that don't transmit
+    virtual unsigned short channelPeriod() const;
+    virtual void setChannelPeriod(unsigned short period);
+    virtual bool fixedChannelPeriod() const; // period mandated by the profile
+
+    // RF channel in MHz above 2400
+    virtual unsigned char channelFrequency() const;
+    virtual void setChannelFrequency(unsigned char frequency); // used by the next configureChannel()
+    virtual bool fixedChannelFrequency() const; // ANT+ profiles must stay on 57
 };
 
 #endif // ANTDEVICE_H
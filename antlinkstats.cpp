@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "antlinkstats.h"
+
+ANTLinkStats::ANTLinkStats()
+{
+    for (int i = 0; i < StickCounterCount; ++i)
+        m_stick[i].store(0, std::memory_order_relaxed);
+
+    for (int ch = 0; ch < ANT_MAX_CHANNELS; ++ch)
+        for (int i = 0; i < ChannelCounterCount; ++i)
+            m_channels[ch][i].store(0, std::memory_order_relaxed);
+}
+
+void ANTLinkStats::countEvent(int channel, unsigned char code)
+{
+    switch (code)
+    {
+    case EVENT_TX:
+        count(channel, TxEvents);
+        break;
+    case EVENT_CHANNEL_COLLISION:
+        count(channel, Collisions);
+        break;
+    case EVENT_TRANSFER_TX_COMPLETED:
+        count(channel, TxCompleted);
+        break;
+    case EVENT_TRANSFER_TX_FAILED:
+        count(channel, TxFailed);
+        break;
+    case EVENT_RX_FAIL:
+        count(channel, RxFails);
+        break;
+    case EVENT_TRANSFER_RX_FAILED:
+        count(channel, RxTransferFails);
+        break;
+    case EVENT_RX_SEARCH_TIMEOUT:
+        count(channel, RxSearchTimeouts);
+        break;
+    default:
+        count(channel, OtherEvents);
+        break;
+    }
+}
+
+ANTLinkStats::Snapshot ANTLinkStats::snapshot() const
+{
+    Snapshot s;
+
+    for (int i = 0; i < StickCounterCount; ++i)
+        s.stick[i] = m_stick[i].load(std::memory_order_relaxed);
+
+    for (int ch = 0; ch < ANT_MAX_CHANNELS; ++ch)
+        for (int i = 0; i < ChannelCounterCount; ++i)
+            s.channels[ch][i] = m_channels[ch][i].load(std::memory_order_relaxed);
+
+    return s;
+}
+
+double ANTLinkStats::Snapshot::collisionRate(int channel) const
+{
+    // an acknowledged transfer uses the slot instead of an EVENT_TX
+    const quint64 txSlots = channels[channel][TxEvents] + channels[channel][Collisions]
+                        + channels[channel][TxCompleted] + channels[channel][TxFailed];
+
+    return txSlots ? double(channels[channel][Collisions]) / txSlots : 0.0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTLINKSTATS_H
+#define ANTLINKSTATS_H
+
+#include <QtGlobal>
+#include <atomic>
+#include "antmessage.h"
+
+/*
+ * Link quality counters for one stick and its channels. They're bumped
+ * from the stick's receive thread with relaxed atomics and can be read
+ * from anywhere with snapshot(), which is consistent per counter but not
+ * across counters.
+ */
+class ANTLinkStats
+{
+public:
+    enum ChannelCounter {
+        TxEvents,           // EVENT_TX, a broadcast went out
+        Collisions,         // EVENT_CHANNEL_COLLISION, a slot was lost to another channel
+        TxCompleted,        // EVENT_TRANSFER_TX_COMPLETED, an ack we sent was acknowledged
+        TxFailed,           // EVENT_TRANSFER_TX_FAILED, an ack we sent wasn't
+        RxFails,            // EVENT_RX_FAIL
+        RxTransferFails,    // EVENT_TRANSFER_RX_FAILED
+        RxSearchTimeouts,   // EVENT_RX_SEARCH_TIMEOUT
+        BroadcastsReceived,
+        AcksReceived,
+        OtherEvents,
+        ChannelCounterCount
+    };
+
+    enum StickCounter {
+        Frames,             // valid frames received
+        ChecksumErrors,
+        Resyncs,            // bytes thrown away looking for the next sync byte
+        StickCounterCount
+    };
+
+    struct Snapshot {
+        quint64 stick[StickCounterCount];
+        quint64 channels[ANT_MAX_CHANNELS][ChannelCounterCount];
+
+        double collisionRate(int channel) const; // collisions per transmission slot
+    };
+
+    ANTLinkStats();
+
+    void count(StickCounter counter)
+    {
+        m_stick[counter].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void count(int channel, ChannelCounter counter)
+    {
+        if (channel >= 0 && channel < ANT_MAX_CHANNELS)
+            m_channels[channel][counter].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // classify an RF event (message id 1) from the channel
+    void countEvent(int channel, unsigned char code);
+
+    quint64 value(int channel, ChannelCounter counter) const
+    {
+        if (channel < 0 || channel >= ANT_MAX_CHANNELS)
+            return 0;
+        return m_channels[channel][counter].load(std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<quint64> m_stick[StickCounterCount];
+    std::atomic<quint64> m_channels[ANT_MAX_CHANNELS][ChannelCounterCount];
+};
+
+#endif // ANTLINKSTATS_H
@@ -87,6 +87,12 @@ ANTMessage::ANTMessage(const unsigned char * message)
     }
 }
 
+ANTMessage ANTMessage::setNetworkKey(const unsigned char network,
+                                     const unsigned char *key)
+{
+    return ANTMessage(9, ANT_SET_NETWORK, network, key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7]);
+}
+
 ANTMessage ANTMessage::assignChannel(const unsigned char channel,
                                      const unsigned char type,
                                      const unsigned char network)
@@ -122,3 +128,110 @@ ANTMessage ANTMessage::open(const unsigned char channel)
 {
     return ANTMessage(1, ANT_OPEN_CHANNEL, channel);
 }
+
+ANTMessage ANTMessage::close(const unsigned char channel)
+{
+    // The stick answers with EVENT_CHANNEL_CLOSED once the channel is down
+    return ANTMessage(1, ANT_CLOSE_CHANNEL, channel);
+}
+
+ANTMessage ANTMessage::unassignChannel(const unsigned char channel)
+{
+    return ANTMessage(1, ANT_UNASSIGN_CHANNEL, channel);
+}
+
+ANTMessage ANTMessage::openRxScanMode()
+{
+    // Always uses channel 0, the radio listens continuously until closed
+    return ANTMessage(1, ANT_OPEN_RX_SCAN_CH, 0);
+}
+
+ANTMessage ANTMessage::setTxPower(const unsigned char level)
+{
+    // All channels, ANT_TX_POWER_LEVEL_*
+    return ANTMessage(2, ANT_TX_POWER, 0, level);
+}
+
+ANTMessage ANTMessage::setChannelTxPower(const unsigned char channel,
+                                         const unsigned char level)
+{
+    // Only on sticks reporting ANT_CAPS_PER_CHANNEL_TX_POWER
+    return ANTMessage(2, ANT_CHANNEL_TX_POWER, channel, level);
+}
+
+ANTMessage ANTMessage::enableExtendedMessages(const bool enable)
+{
+    // Adds the transmitting device's channel id after the payload of received data
+    return ANTMessage(2, ANT_ENABLE_EXT_MSGS, 0, enable ? 1 : 0);
+}
+
+ANTMessage ANTMessage::requestMessage(const unsigned char channel, const unsigned char messageId)
+{
+    return ANTMessage(2, ANT_REQ_MESSAGE, channel, messageId);
+}
+
+ANTMessage ANTMessage::setLibConfig(const unsigned char flags)
+{
+    // Selects which ANT_EXT_FLAG_* fields are appended to every received data message
+    return ANTMessage(2, ANT_LIB_CONFIG, 0, flags);
+}
+
+ANTMessage ANTMessage::fromFrame(const unsigned char *frame)
+{
+    ANTMessage m;
+    const int len = qMin(int(frame[ANT_OFFSET_LENGTH]), ANT_MAX_LENGTH);
+
+    memcpy(m.data, frame, len + 3);
+
+    unsigned char crc = 0;
+    for (int i = 0; i < len + 3; i++) crc ^= m.data[i];
+    m.data[len + 3] = crc;
+
+    m.length = len + 4;
+    return m;
+}
+
+bool ANTMessage::parseExtendedData(const unsigned char *ant_message, ANTExtendedData &ext)
+{
+    // byte 4-11 payload
+    // byte 12 flag
+    // byte 13- fields in flag bit order
+
+    memset(&ext, 0, sizeof(ext));
+
+    const int length = ant_message[ANT_OFFSET_LENGTH];
+    if (length < 10)
+        return false;
+
+    ext.flags = ant_message[ANT_OFFSET_EXT_FLAG];
+    const unsigned char *field = ant_message + ANT_OFFSET_EXT_FLAG + 1;
+    const unsigned char *end = ant_message + ANT_OFFSET_DATA + length;
+
+    if (ext.flags & ANT_EXT_FLAG_CHANNEL_ID)
+    {
+        if (field + 4 > end)
+            return false;
+        ext.deviceNumber = field[0] | (field[1] << 8);
+        ext.deviceType = field[2];
+        ext.transmissionType = field[3];
+        field += 4;
+    }
+
+    if (ext.flags & ANT_EXT_FLAG_RSSI)
+    {
+        if (field + 3 > end)
+            return false;
+        ext.rssi = (signed char)field[1];
+        ext.threshold = (signed char)field[2];
+        field += 3;
+    }
+
+    if (ext.flags & ANT_EXT_FLAG_TIMESTAMP)
+    {
+        if (field + 2 > end)
+            return false;
+        ext.rxTimestamp = field[0] | (field[1] << 8);
+    }
+
+    return true;
+}
@@ -22,6 +22,7 @@
 #define ANTMESSAGE_H
 
 #include <cstdint>
+#include <cstring>
 
 // Channel messages
 #define RESPONSE_NO_ERROR               0
@@ -46,11 +47,20 @@
 
 // other ANT stuff
 #define ANT_SYNC_BYTE        0xA4
-#define ANT_MAX_LENGTH       9
+#define ANT_MAX_LENGTH       19 // 9 + flag byte + channel id (4) + rssi (3) + timestamp (2)
 #define ANT_KEY_LENGTH       8
 #define ANT_MAX_BURST_DATA   8
-#define ANT_MAX_MESSAGE_SIZE 12
-#define ANT_MAX_CHANNELS     8
+#define ANT_MAX_MESSAGE_SIZE 23
+#define ANT_MAX_CHANNELS     15 // largest channel count a stick reports
+#define ANT_DEFAULT_CHANNELS 8 // until the stick tells us otherwise
+#define ANT_DEFAULT_NETWORKS 3
+#define ANT_SPORT_FREQUENCY  57 // 2457 MHz, mandatory for ANT+ profiles
+#define ANT_MAX_FREQUENCY    124 // 2524 MHz
+
+// Transmit power levels, about -20, -12, -6, 0 and +4 dBm depending on the stick
+#define ANT_TX_POWER_LEVEL_MIN     0
+#define ANT_TX_POWER_LEVEL_DEFAULT 3
+#define ANT_TX_POWER_LEVEL_MAX     4
 
 // ANT message structure.
 #define ANT_OFFSET_SYNC            0
@@ -58,8 +68,18 @@
 #define ANT_OFFSET_ID              2
 #define ANT_OFFSET_DATA            3
 #define ANT_OFFSET_CHANNEL_NUMBER  3
+#define ANT_CHANNEL_NUMBER_MASK    0x1F // the top three bits carry the sequence number on burst data
 #define ANT_OFFSET_MESSAGE_ID      4
 #define ANT_OFFSET_MESSAGE_CODE    5
+#define ANT_OFFSET_EXT_FLAG        12 // flag byte following the 8 byte payload
+
+// Extended message flag bits, the fields follow the flag byte in this order
+#define ANT_EXT_FLAG_CHANNEL_ID    0x80 // device number (2), device type, transmission type
+#define ANT_EXT_FLAG_RSSI          0x40 // measurement type, rssi (dBm), threshold (dBm)
+#define ANT_EXT_FLAG_TIMESTAMP     0x20 // rx time in 1/32768 s, rolls over every 2 s
+
+// ANT_CAPABILITIES advanced options (data byte 3)
+#define ANT_CAPS_PER_CHANNEL_TX_POWER 0x10
 
 // ANT messages
 #define ANT_UNASSIGN_CHANNEL   0x41
@@ -77,6 +97,7 @@
 #define ANT_SET_SERIAL_NUMBER  0x65
 #define ANT_ENABLE_EXT_MSGS    0x66
 #define ANT_ENABLE_LED         0x68
+#define ANT_LIB_CONFIG         0x6E
 #define ANT_SYSTEM_RESET       0x4A
 #define ANT_OPEN_CHANNEL       0x4B
 #define ANT_CLOSE_CHANNEL      0x4C
@@ -96,6 +117,46 @@
 #define ANT_CW_TEST            0x48
 
 
+// XOR of a list of bytes, evaluated at compile time when the bytes are constants
+constexpr unsigned char antXor() { return 0; }
+
+template <typename... Bytes>
+constexpr unsigned char antXor(unsigned char b, Bytes... rest) { return b ^ antXor(rest...); }
+
+/*
+ * A broadcast page with an 8 byte payload fixed at compile time. The channel
+ * is the only thing not known up front, so the checksum is computed for
+ * channel 0 and the channel is xor'ed in when the message is built.
+ */
+template <unsigned char... Payload>
+struct ANTStaticPage
+{
+    static_assert(sizeof...(Payload) == 8, "ANT pages carry 8 bytes");
+
+    static constexpr unsigned char payload[8] = { Payload... };
+    static constexpr unsigned char checksum = antXor(ANT_SYNC_BYTE, 9, ANT_BROADCAST_DATA, Payload...);
+};
+
+template <unsigned char... Payload>
+constexpr unsigned char ANTStaticPage<Payload...>::payload[8];
+
+// Common page 80, manufacturer 0x00FF (reserved for development), hw rev 1, model 1
+typedef ANTStaticPage<0x50, 0xFF, 0xFF, 0x01, 0xFF, 0x00, 0x01, 0x00> ANTCommonPage80;
+
+// Common page 81, sw rev 1, 0xFFFFFFFF for devices without serial number
+typedef ANTStaticPage<0x51, 0xFF, 0xFF, 0x01, 0xFF, 0xFF, 0xFF, 0xFF> ANTCommonPage81;
+
+// Fields the stick appended to a received data message
+struct ANTExtendedData
+{
+    unsigned char flags; // ANT_EXT_FLAG_* present in the message
+    unsigned short deviceNumber;
+    unsigned char deviceType;
+    unsigned char transmissionType;
+    signed char rssi;
+    signed char threshold;
+    unsigned short rxTimestamp;
+};
 
 class ANTMessage
 {
@@ -114,6 +175,9 @@ public:
                unsigned char b10 = '\0',
                unsigned char b11 = '\0'); // encode with values (at least one value must be passed though)
 
+    static ANTMessage setNetworkKey(const unsigned char network,
+                                    const unsigned char *key);
+
     static ANTMessage assignChannel(const unsigned char channel,
                                     const unsigned char type,
                                     const unsigned char network);
@@ -131,6 +195,60 @@ public:
 
     static ANTMessage open(const unsigned char channel);
 
+    static ANTMessage close(const unsigned char channel);
+
+    static ANTMessage unassignChannel(const unsigned char channel);
+
+    static ANTMessage openRxScanMode();
+
+    static ANTMessage setTxPower(const unsigned char level);
+
+    static ANTMessage setChannelTxPower(const unsigned char channel,
+                                        const unsigned char level);
+
+    static ANTMessage enableExtendedMessages(const bool enable);
+
+    static ANTMessage setLibConfig(const unsigned char flags);
+
+    static ANTMessage requestMessage(const unsigned char channel,
+                                     const unsigned char messageId);
+
+    // copy of a complete frame from elsewhere, with the checksum recomputed
+    static ANTMessage fromFrame(const unsigned char *frame);
+
+    static bool parseExtendedData(const unsigned char *ant_message, ANTExtendedData &ext);
+
+    template <class Page>
+    static ANTMessage staticPage(const unsigned char channel)
+    {
+        ANTMessage m;
+        m.data[0] = ANT_SYNC_BYTE;
+        m.data[1] = 9;
+        m.data[2] = ANT_BROADCAST_DATA;
+        m.data[3] = channel;
+        memcpy(m.data + 4, Page::payload, 8);
+        m.data[12] = Page::checksum ^ channel;
+        m.length = 13;
+        return m;
+    }
+
+    // Change byte index (0-7) of the page payload in place, the checksum is
+    // patched rather than recomputed
+    void setPageByte(const int index, const unsigned char value)
+    {
+        unsigned char &byte = data[ANT_OFFSET_DATA + 1 + index];
+        data[length - 1] ^= byte ^ value;
+        byte = value;
+    }
+
+    // Turn a data message into another kind, broadcast into acknowledged for
+    // instance, the checksum is patched like above
+    void setMessageId(const unsigned char id)
+    {
+        data[length - 1] ^= data[ANT_OFFSET_ID] ^ id;
+        data[ANT_OFFSET_ID] = id;
+    }
+
     unsigned char data[ANT_MAX_MESSAGE_SIZE+1]; // include sync byte at front
     int length;
     uint8_t sync, type;
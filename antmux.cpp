@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "antmux.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QVector>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "LibUsb.h"
+#include "anttrace.h"
+
+#define ANT_MUX_UNMAPPED 0xFF
+
+// commands about the stick rather than a channel, byte 3 isn't a channel number
+static bool isStickWide(unsigned char messageId)
+{
+    switch (messageId)
+    {
+    case ANT_SET_NETWORK:
+    case ANT_LIB_CONFIG:
+    case ANT_ENABLE_EXT_MSGS:
+    case ANT_TX_POWER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ANTMux::ANTMux(const QString &socketPath, ANTTransport *transport) :
+    m_socketPath(socketPath),
+    m_transport(transport),
+    m_tx(0),
+    m_stickUp(false),
+    m_maxChannels(ANT_DEFAULT_CHANNELS),
+    m_capabilitiesKnown(false),
+    m_rxCount(0)
+{
+    if (!m_transport)
+        m_transport = new LibUsb(TYPE_ANT);
+
+    m_tx = new ANTTransmitter(m_transport);
+
+    for (int i = 0; i < ANT_MAX_CHANNELS; ++i)
+    {
+        m_owner[i] = Free;
+        m_ownerChannel[i] = 0;
+    }
+
+    // until the stick tells us otherwise
+    const ANTMessage caps(4, ANT_CAPABILITIES, ANT_DEFAULT_CHANNELS, ANT_DEFAULT_NETWORKS, 0, 0);
+    memcpy(m_capabilities, caps.data, caps.length);
+}
+
+QString ANTMux::socketPath()
+{
+    const QByteArray path = qgetenv("ANT_MUX");
+    if (!path.isEmpty())
+        return QString::fromLocal8Bit(path);
+
+    // private to the user, unlike /tmp
+    const QByteArray runtime = qgetenv("XDG_RUNTIME_DIR");
+    return QString::fromLocal8Bit(runtime.isEmpty() ? QByteArray("/run") : runtime) + "/" + ANT_MUX_SOCKET;
+}
+
+void ANTMux::run()
+{
+    while (1)
+    {
+        if (m_transport->open(QString()) < 0)
+        {
+            msleep(1000);
+            continue;
+        }
+
+        m_rxCount = 0;
+        m_tx->setLinkUp(true);
+        m_tx->start(QThread::HighPriority);
+
+        ANTMessage request = ANTMessage::requestMessage(0, ANT_CAPABILITIES);
+        m_tx->send(request, ANTTransmitter::Command);
+
+        int readErrors = 0;
+        QElapsedTimer timer;
+        timer.start();
+
+        while (readErrors < 3 && !m_tx->linkLost())
+        {
+            // clients are let in once we know how many channels there are to share
+            if (!m_stickUp.load() && (m_capabilitiesKnown || timer.elapsed() > 1000))
+            {
+                qDebug() << "ANTMux: stick open with" << m_maxChannels << "channels";
+                m_stickUp.store(true);
+            }
+
+            unsigned char byte;
+            const int rc = m_transport->read((char *)&byte, 1);
+
+            ANTTrace::pollDumpRequest();
+
+            if (rc > 0)
+            {
+                readErrors = 0;
+                receiveByte(byte);
+                continue;
+            }
+
+            if (rc < 0 && LibUsb::isFatalError(rc))
+                ++readErrors;
+
+            msleep(5);
+        }
+
+        linkDown();
+    }
+}
+
+void ANTMux::linkDown()
+{
+    qDebug() << "ANTMux: stick lost, disconnecting clients";
+
+    m_stickUp.store(false);
+    m_tx->setLinkUp(false);
+    m_transport->close();
+
+    QMutexLocker locker(&m_mutex);
+
+    // serve() sees them hang up and forgets them, their channels went with the stick
+    foreach (const Client &client, m_clients)
+        shutdown(client.fd, SHUT_RDWR);
+
+    for (int i = 0; i < ANT_MAX_CHANNELS; ++i)
+        m_owner[i] = Free;
+
+    m_stickWideRequests.clear();
+    m_capabilitiesKnown = false;
+}
+
+void ANTMux::receiveByte(unsigned char byte)
+{
+    if (m_rxCount == 0 && byte != ANT_SYNC_BYTE)
+        return;
+
+    if (m_rxCount == ANT_OFFSET_LENGTH && (byte == 0 || byte > ANT_MAX_LENGTH))
+    {
+        m_rxCount = 0;
+        return;
+    }
+
+    m_rxFrame[m_rxCount++] = byte;
+
+    if (m_rxCount < 4 || m_rxCount < m_rxFrame[ANT_OFFSET_LENGTH] + 4)
+        return;
+
+    unsigned char checksum = 0;
+    for (int i = 0; i < m_rxCount; ++i)
+        checksum ^= m_rxFrame[i];
+
+    if (checksum == 0)
+    {
+        ANTTrace::record(ANTTrace::Rx, m_rxFrame);
+        routeStickFrame(m_rxFrame, m_rxCount);
+        sendQueued();
+    }
+
+    m_rxCount = 0;
+}
+
+void ANTMux::routeStickFrame(unsigned char *frame, int length)
+{
+    const unsigned char id = frame[ANT_OFFSET_ID];
+
+    QMutexLocker locker(&m_mutex);
+
+    switch (id)
+    {
+    case ANT_CAPABILITIES:
+        m_maxChannels = qMin(int(frame[ANT_OFFSET_DATA]), ANT_MAX_CHANNELS);
+        memcpy(m_capabilities, frame, length);
+        m_capabilitiesKnown = true;
+        return;
+
+    case ANT_BROADCAST_DATA:
+    case ANT_ACK_DATA:
+    case ANT_BURST_DATA:
+    case ANT_CHANNEL_EVENT:
+    case ANT_CHANNEL_STATUS:
+    case ANT_CHANNEL_ID:
+        break;
+
+    default:
+        // startup, version, serial number, about the stick everyone shares
+        foreach (const Client &client, m_clients)
+            sendToClient(client.fd, frame, length);
+        return;
+    }
+
+    const bool response = (id == ANT_CHANNEL_EVENT);
+
+    if (response && isStickWide(frame[ANT_OFFSET_MESSAGE_ID]))
+    {
+        // the stick answers commands in the order they went out
+        if (!m_stickWideRequests.isEmpty())
+        {
+            const int fd = m_stickWideRequests.takeFirst();
+            if (m_clients.contains(fd))
+                sendToClient(fd, frame, length);
+        }
+        return;
+    }
+
+    const unsigned char channel = frame[ANT_OFFSET_CHANNEL_NUMBER] & ANT_CHANNEL_NUMBER_MASK;
+    if (channel >= ANT_MAX_CHANNELS || m_owner[channel] == Free)
+        return;
+
+    const unsigned char messageId = frame[ANT_OFFSET_MESSAGE_ID];
+    const unsigned char code = frame[ANT_OFFSET_MESSAGE_CODE];
+
+    if (m_owner[channel] == Releasing)
+    {
+        // close, then unassign, then the channel is free for the next client
+        if (response && ((messageId == 1 && code == EVENT_CHANNEL_CLOSED) ||
+                         (messageId == ANT_CLOSE_CHANNEL && code != RESPONSE_NO_ERROR)))
+        {
+            ANTMessage unassign = ANTMessage::unassignChannel(channel);
+            queue(unassign, ANTTransmitter::Command);
+        }
+        else if (response && messageId == ANT_UNASSIGN_CHANNEL)
+        {
+            m_owner[channel] = Free;
+        }
+        return;
+    }
+
+    const int fd = m_owner[channel];
+    const unsigned char clientChannel = m_ownerChannel[channel];
+
+    if (response && messageId == ANT_UNASSIGN_CHANNEL && code == RESPONSE_NO_ERROR)
+    {
+        m_clients[fd].stickChannel[clientChannel] = ANT_MUX_UNMAPPED;
+        m_owner[channel] = Free;
+    }
+
+    setChannel(frame, length, clientChannel);
+    sendToClient(fd, frame, length);
+}
+
+int ANTMux::serve()
+{
+    const QByteArray path = m_socketPath.toLocal8Bit();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= (int)sizeof(addr.sun_path))
+    {
+        qDebug() << "ANTMux: socket path too long" << m_socketPath;
+        return -ENAMETOOLONG;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    const int listenFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (listenFd < 0)
+        return -errno;
+
+    // a previous multiplexer may have left its socket behind, anything else
+    // at that path isn't ours to remove
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            qDebug() << "ANTMux:" << m_socketPath << "exists and isn't a socket, not replacing it";
+            ::close(listenFd);
+            return -EEXIST;
+        }
+        unlink(addr.sun_path);
+    }
+
+    // no window between bind() and chmod() where others could connect
+    const mode_t mask = umask(0777 & ~ANT_MUX_SOCKET_MODE);
+    const int bound = bind(listenFd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+
+    if (bound < 0 || chmod(addr.sun_path, ANT_MUX_SOCKET_MODE) < 0 || listen(listenFd, ANT_MUX_MAX_CLIENTS) < 0)
+    {
+        const int err = errno;
+        qDebug() << "ANTMux: can't listen on" << m_socketPath << strerror(err);
+        ::close(listenFd);
+        return -err;
+    }
+
+    qDebug() << "ANTMux: sharing the stick on" << m_socketPath;
+
+    while (1)
+    {
+        QVector<struct pollfd> fds;
+        struct pollfd listening = {listenFd, POLLIN, 0};
+        fds.append(listening);
+        {
+            QMutexLocker locker(&m_mutex);
+            foreach (const Client &client, m_clients)
+            {
+                struct pollfd p = {client.fd, POLLIN, 0};
+                fds.append(p);
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), 1000) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+            acceptClient(listenFd);
+
+        for (int i = 1; i < fds.size(); ++i)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            unsigned char frame[ANT_MAX_MESSAGE_SIZE];
+            const int n = recv(fds[i].fd, frame, sizeof(frame), MSG_DONTWAIT);
+
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            {
+                dropClient(fds[i].fd);
+                continue;
+            }
+
+            if (n < 0)
+                continue;
+
+            if (n < 4 || frame[0] != ANT_SYNC_BYTE || frame[ANT_OFFSET_LENGTH] + 4 != n)
+            {
+                qDebug() << "ANTMux: dropping malformed frame from client" << fds[i].fd;
+                continue;
+            }
+
+            {
+                QMutexLocker locker(&m_mutex);
+                if (m_stickUp.load() && m_clients.contains(fds[i].fd))
+                    handleClientFrame(m_clients[fds[i].fd], frame, n);
+            }
+            sendQueued();
+        }
+    }
+}
+
+bool ANTMux::acceptClient(int listenFd)
+{
+    const int fd = accept(listenFd, 0, 0);
+    if (fd < 0)
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+
+    // without a stick the client finds out the same way as when it goes away
+    if (!m_stickUp.load() || m_clients.size() >= ANT_MUX_MAX_CLIENTS)
+    {
+        qDebug() << "ANTMux: turning away client," << (m_stickUp.load() ? "too many clients" : "no stick");
+        ::close(fd);
+        return false;
+    }
+
+    Client client;
+    client.fd = fd;
+    memset(client.stickChannel, ANT_MUX_UNMAPPED, sizeof(client.stickChannel));
+    m_clients.insert(fd, client);
+
+    qDebug() << "ANTMux: client" << fd << "connected," << m_clients.size() << "clients";
+    return true;
+}
+
+void ANTMux::dropClient(int fd)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (m_clients.contains(fd))
+        {
+            const Client client = m_clients.take(fd);
+            for (int i = 0; i < ANT_MAX_CHANNELS; ++i)
+            {
+                const unsigned char channel = client.stickChannel[i];
+                if (channel != ANT_MUX_UNMAPPED && m_owner[channel] == fd)
+                    releaseChannel(channel);
+            }
+        }
+
+        ::close(fd);
+        qDebug() << "ANTMux: client" << fd << "disconnected," << m_clients.size() << "clients";
+    }
+
+    sendQueued();
+}
+
+void ANTMux::releaseChannel(int channel)
+{
+    // unassigned once the stick has closed it, see routeStickFrame()
+    m_owner[channel] = Releasing;
+
+    ANTMessage closeChan = ANTMessage::close(channel);
+    queue(closeChan, ANTTransmitter::Command);
+}
+
+int ANTMux::allocateChannel(Client &client, unsigned char clientChannel)
+{
+    int channel = -1;
+
+    // scan mode only works on channel 0, so that's where client channel 0 goes if it can
+    if (clientChannel == 0 && m_owner[0] == Free)
+        channel = 0;
+
+    for (int i = 1; channel < 0 && i < m_maxChannels; ++i)
+    {
+        if (m_owner[i] == Free)
+            channel = i;
+    }
+
+    if (channel < 0 && m_owner[0] == Free)
+        channel = 0;
+
+    if (channel < 0)
+        return -1;
+
+    m_owner[channel] = client.fd;
+    m_ownerChannel[channel] = clientChannel;
+    client.stickChannel[clientChannel] = channel;
+    return channel;
+}
+
+int ANTMux::availableChannels(const Client &client) const
+{
+    int count = 0;
+    for (int i = 0; i < m_maxChannels; ++i)
+    {
+        if (m_owner[i] == Free || m_owner[i] == client.fd)
+            count++;
+    }
+    return count;
+}
+
+void ANTMux::handleClientFrame(Client &client, unsigned char *frame, int length)
+{
+    // m_mutex is held
+    const unsigned char id = frame[ANT_OFFSET_ID];
+    const unsigned char clientChannel = frame[ANT_OFFSET_CHANNEL_NUMBER] & ANT_CHANNEL_NUMBER_MASK;
+
+    switch (id)
+    {
+    case ANT_SYSTEM_RESET:
+    {
+        // only the client's share of the stick is reset
+        for (int i = 0; i < ANT_MAX_CHANNELS; ++i)
+        {
+            const unsigned char channel = client.stickChannel[i];
+            if (channel != ANT_MUX_UNMAPPED && m_owner[channel] == client.fd)
+                releaseChannel(channel);
+            client.stickChannel[i] = ANT_MUX_UNMAPPED;
+        }
+
+        const ANTMessage startup(1, ANT_NOTIF_STARTUP, 0x20); // command reset
+        sendToClient(client.fd, startup.data, startup.length);
+        return;
+    }
+
+    case ANT_REQ_MESSAGE:
+        switch (frame[ANT_OFFSET_DATA + 1])
+        {
+        case ANT_CAPABILITIES:
+        {
+            unsigned char caps[ANT_MAX_MESSAGE_SIZE];
+            const int capsLength = m_capabilities[ANT_OFFSET_LENGTH] + 4;
+            memcpy(caps, m_capabilities, capsLength);
+            setChannel(caps, capsLength, availableChannels(client)); // byte 3 is the channel count here
+            sendToClient(client.fd, caps, capsLength);
+            return;
+        }
+        case ANT_CHANNEL_STATUS:
+        case ANT_CHANNEL_ID:
+            break; // about one channel
+        default:
+            forward(frame);
+            return;
+        }
+        break;
+
+    default:
+        if (isStickWide(id))
+        {
+            // shared with everyone, only the response is the client's own
+            m_stickWideRequests.append(client.fd);
+            forward(frame);
+            return;
+        }
+        break;
+    }
+
+    if (clientChannel >= ANT_MAX_CHANNELS)
+    {
+        respond(client.fd, clientChannel, id, INVALID_MESSAGE);
+        return;
+    }
+
+    if (client.stickChannel[clientChannel] == ANT_MUX_UNMAPPED && id == ANT_ASSIGN_CHANNEL
+            && allocateChannel(client, clientChannel) < 0)
+    {
+        qDebug() << "ANTMux: no free channel for client" << client.fd;
+    }
+
+    const unsigned char channel = client.stickChannel[clientChannel];
+    if (channel == ANT_MUX_UNMAPPED)
+    {
+        // same as a real stick answers for a channel that isn't assigned
+        respond(client.fd, clientChannel, id, CHANNEL_IN_WRONG_STATE);
+        return;
+    }
+
+    setChannel(frame, length, channel);
+    forward(frame);
+}
+
+void ANTMux::forward(const unsigned char *frame)
+{
+    const ANTMessage m = ANTMessage::fromFrame(frame);
+    queue(m, frame[ANT_OFFSET_ID] == ANT_BROADCAST_DATA ? ANTTransmitter::Broadcast : ANTTransmitter::Command);
+}
+
+void ANTMux::queue(const ANTMessage &message, ANTTransmitter::Priority priority)
+{
+    // m_mutex is held
+    m_queued.append(qMakePair(message, priority));
+}
+
+void ANTMux::sendQueued()
+{
+    // A command send waits for room in the transmit queue, which would
+    // hold up every client and the stick side if done under m_mutex
+    QList<QPair<ANTMessage, ANTTransmitter::Priority> > queued;
+    {
+        QMutexLocker locker(&m_mutex);
+        queued.swap(m_queued);
+    }
+
+    for (int i = 0; i < queued.size(); ++i)
+        m_tx->send(queued[i].first, queued[i].second);
+}
+
+void ANTMux::sendToClient(int fd, const unsigned char *frame, int length)
+{
+    // a client that doesn't keep up loses frames rather than holding up the stick
+    send(fd, frame, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void ANTMux::respond(int fd, unsigned char channel, unsigned char messageId, unsigned char code)
+{
+    const ANTMessage m(3, ANT_CHANNEL_EVENT, channel, messageId, code);
+    sendToClient(fd, m.data, m.length);
+}
+
+void ANTMux::setChannel(unsigned char *frame, int length, unsigned char channel)
+{
+    // a burst keeps its sequence number, only the channel is swapped
+    if (frame[ANT_OFFSET_ID] == ANT_BURST_DATA)
+        channel |= frame[ANT_OFFSET_CHANNEL_NUMBER] & ~ANT_CHANNEL_NUMBER_MASK;
+
+    frame[length - 1] ^= frame[ANT_OFFSET_CHANNEL_NUMBER] ^ channel;
+    frame[ANT_OFFSET_CHANNEL_NUMBER] = channel;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef ANTMUX_H
+#define ANTMUX_H
+
+#include <QThread>
+#include <QString>
+#include <QMap>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <atomic>
+#include "antmessage.h"
+#include "anttransport.h"
+#include "anttransmitter.h"
+
+#define ANT_MUX_SOCKET      "monark-ant-mux" // in XDG_RUNTIME_DIR or /run, unless ANT_MUX says otherwise
+#define ANT_MUX_SOCKET_MODE 0660 // the owner and its group, nobody else gets at the bike
+#define ANT_MUX_MAX_CLIENTS 8
+
+/*
+ * Owns one ANT stick and shares its channels between processes on the
+ * host, started with --ant-mux. Clients connect to a SOCK_SEQPACKET unix
+ * socket and speak plain ANT to it, one frame per packet, the way they
+ * would to a stick of their own (see ANTMuxClient). The socket is only
+ * open to the user and group running the multiplexer.
+ *
+ * Channel numbers are the client's own. The first ANT_ASSIGN_CHANNEL on
+ * a channel maps it onto a free stick channel, client channel 0 onto stick
+ * channel 0 when it's free so scan mode keeps working, and frames in both
+ * directions have their channel rewritten. A capabilities request is
+ * answered with the channels not held by other clients. ANT_SYSTEM_RESET
+ * only releases the client's own channels. Network keys, lib config and
+ * the stick wide tx power are shared by everyone, the last client to set
+ * one wins.
+ *
+ * When a client goes away its channels are closed and unassigned before
+ * anyone else gets them. When the stick goes away every client is
+ * disconnected, they see their stick unplugged and reconnect once the
+ * multiplexer has a stick again.
+ */
+class ANTMux : public QThread
+{
+    Q_OBJECT
+public:
+    explicit ANTMux(const QString &socketPath, ANTTransport *transport = 0);
+
+    static QString socketPath(); // ANT_MUX, or ANT_MUX_SOCKET in the runtime directory
+
+    int serve(); // accepts and serves clients in the calling thread, only returns -errno on failure
+
+private:
+    enum {
+        Free = -1,      // m_owner values other than a client's socket
+        Releasing = -2  // owner went away, waiting for the stick to close and unassign it
+    };
+
+    struct Client {
+        int fd;
+        unsigned char stickChannel[ANT_MAX_CHANNELS]; // by client channel, 0xFF when not mapped
+    };
+
+    void run(); // stick side, opens the stick and routes what it sends
+    void receiveByte(unsigned char byte);
+    void routeStickFrame(unsigned char *frame, int length);
+    void linkDown();
+
+    bool acceptClient(int listenFd);
+    void handleClientFrame(Client &client, unsigned char *frame, int length);
+    void dropClient(int fd);
+    void releaseChannel(int channel);
+    int allocateChannel(Client &client, unsigned char channel);
+    int availableChannels(const Client &client) const;
+
+    void forward(const unsigned char *frame);
+    void queue(const ANTMessage &message, ANTTransmitter::Priority priority);
+    void sendQueued();
+    void sendToClient(int fd, const unsigned char *frame, int length);
+    void respond(int fd, unsigned char channel, unsigned char messageId, unsigned char code);
+    static void setChannel(unsigned char *frame, int length, unsigned char channel);
+
+    QString m_socketPath;
+    ANTTransport *m_transport;
+    ANTTransmitter *m_tx;
+    std::atomic<bool> m_stickUp;
+
+    QMutex m_mutex; // everything below, the stick and client sides both use them
+    QMap<int, Client> m_clients;
+    int m_owner[ANT_MAX_CHANNELS]; // client socket, Free or Releasing
+    unsigned char m_ownerChannel[ANT_MAX_CHANNELS];
+    QList<int> m_stickWideRequests; // clients waiting for a response to a stick wide command
+    QList<QPair<ANTMessage, ANTTransmitter::Priority> > m_queued; // sent once m_mutex is released
+    int m_maxChannels;
+    unsigned char m_capabilities[ANT_MAX_MESSAGE_SIZE]; // the stick's reply, handed to clients
+    bool m_capabilitiesKnown;
+
+    unsigned char m_rxFrame[ANT_MAX_MESSAGE_SIZE];
+    int m_rxCount;
+};
+
+#endif // ANTMUX_H
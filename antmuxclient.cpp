@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "antmuxclient.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// read() gives up after this long without data, same as the usb read
+#define ANT_MUX_READ_TIMEOUT_MS 125
+
+ANTMuxClient::ANTMuxClient() :
+    m_fd(-1),
+    m_rxLength(0),
+    m_rxIndex(0)
+{
+}
+
+ANTMuxClient::~ANTMuxClient()
+{
+    close();
+}
+
+int ANTMuxClient::open(const QString &socketPath)
+{
+    close();
+
+    const QByteArray path = socketPath.toLocal8Bit();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= (int)sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    memcpy(addr.sun_path, path.constData(), path.size());
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0)
+        return -errno;
+
+    if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        const int err = errno;
+        ::close(fd);
+        return -err;
+    }
+
+    m_fd = fd;
+    m_rxLength = 0;
+    m_rxIndex = 0;
+    m_tx.clear();
+    return 0;
+}
+
+void ANTMuxClient::close()
+{
+    if (m_fd < 0)
+        return;
+
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+int ANTMuxClient::read(char *buf, int bytes)
+{
+    if (m_fd < 0)
+        return -ENODEV;
+
+    if (m_rxIndex >= m_rxLength)
+    {
+        struct pollfd p = {m_fd, POLLIN, 0};
+        const int rc = poll(&p, 1, ANT_MUX_READ_TIMEOUT_MS);
+        if (rc == 0 || (rc < 0 && errno == EINTR))
+            return -ETIMEDOUT;
+        if (rc < 0)
+            return -errno;
+
+        const int n = recv(m_fd, m_rx, sizeof(m_rx), 0);
+        if (n == 0 || (n < 0 && errno == ECONNRESET))
+            return -ENODEV; // the multiplexer went away
+        if (n < 0)
+            return errno == EINTR ? -ETIMEDOUT : -errno;
+
+        m_rxLength = n;
+        m_rxIndex = 0;
+    }
+
+    const int count = qMin(bytes, m_rxLength - m_rxIndex);
+    memcpy(buf, m_rx + m_rxIndex, count);
+    m_rxIndex += count;
+    return count;
+}
+
+int ANTMuxClient::write(char *buf, int bytes)
+{
+    if (m_fd < 0)
+        return -ENODEV;
+
+    m_tx.append(buf, bytes);
+
+    // the multiplexer takes a whole frame per packet
+    while (m_tx.size() >= 4)
+    {
+        if ((unsigned char)m_tx[0] != ANT_SYNC_BYTE)
+        {
+            m_tx.remove(0, 1);
+            continue;
+        }
+
+        const int length = (unsigned char)m_tx[ANT_OFFSET_LENGTH] + 4;
+        if (m_tx.size() < length)
+            break;
+
+        if (send(m_fd, m_tx.constData(), length, MSG_NOSIGNAL) < 0)
+        {
+            const int err = errno;
+            m_tx.clear();
+            return (err == ECONNRESET || err == EPIPE) ? -ENODEV : -err;
+        }
+
+        m_tx.remove(0, length);
+    }
+
+    return bytes;
+}
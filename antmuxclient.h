@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef ANTMUXCLIENT_H
+#define ANTMUXCLIENT_H
+
+#include <QByteArray>
+#include "anttransport.h"
+#include "antmessage.h"
+
+/*
+ * Transport to a stick shared by ANTMux, the stick id is the
+ * multiplexer's socket. Frames go out one per packet and come back the
+ * same way. The multiplexer going away looks like the stick being
+ * unplugged, reads and writes fail with -ENODEV.
+ */
+class ANTMuxClient : public ANTTransport
+{
+public:
+    ANTMuxClient();
+    ~ANTMuxClient();
+
+    int open(const QString &socketPath);
+    void close();
+    int read(char *buf, int bytes);
+    int write(char *buf, int bytes);
+    bool shared() const {return true;}
+
+private:
+    int m_fd;
+
+    // read side, the rest of the last frame received
+    unsigned char m_rx[ANT_MAX_MESSAGE_SIZE];
+    int m_rxLength;
+    int m_rxIndex;
+
+    // write side, the start of a frame that hasn't been written in full yet
+    QByteArray m_tx;
+};
+
+#endif // ANTMUXCLIENT_H
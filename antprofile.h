@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTPROFILE_H
+#define ANTPROFILE_H
+
+#include <QDebug>
+#include "antmessage.h"
+#include "antdevice.h"
+#include "pagescheduler.h"
+#include "channelconfig.h"
+#include "anttransmitter.h"
+
+#define ANT_PAGE_REQUEST          0x46 // common page 70
+#define ANT_PAGE_REQUEST_RETRIES  4 // failed acknowledged replies resent before giving up
+#define ANT_PAGE_REQUEST_UNTIL_ACK_RETRIES 120 // the same for 0x80, about 30s at 4Hz
+
+/*
+ * Channel plumbing shared by all master profiles. A profile derives from
+ * ANTProfile<itself> and declares:
+ *
+ *   static const unsigned char DeviceType, TransmissionType, Network;
+ *   static const unsigned short Period;       // 1/32768s
+ *   static const bool FixedPeriod;            // period mandated by the profile spec
+ *   static const bool FixedFrequency;         // false for private channels only
+ *   static const int MainPageCount;           // see PageScheduler
+ *   static const int CommonPageRepeat;
+ *   static QVector<int> pagePattern();
+ *   static const char *name();
+ *   const ANTMessage &encodePage(int page);   // every page in pagePattern()
+ *
+ * Period and the page rotation are defaults, see ChannelConfig for changing
+ * them per profile at runtime.
+ *
+ * and optionally handleAckPage(), handleChannelEvent() and requestedPage()
+ * to replace the defaults below. Channel events, ack validation,
+ * configuration, common pages 80/81 and page requests (common page 70) are
+ * done here, and the calls into the profile are resolved at compile time.
+ * ANT still reaches the channel through ANTDevice, once per message.
+ *
+ * A requested page takes the place of the scheduled one on the next
+ * EVENT_TX, as many times as asked for. When the requester wants it
+ * acknowledged it's sent as acknowledged data and only counts once the
+ * stick reports EVENT_TRANSFER_TX_COMPLETED, a failed transfer is resent up
+ * to ANT_PAGE_REQUEST_RETRIES times. A request for 0x80 transmissions means
+ * until acknowledged, that one keeps going for up to
+ * ANT_PAGE_REQUEST_UNTIL_ACK_RETRIES failed transfers in case the
+ * requester has gone away altogether.
+ */
+template <class Profile>
+class ANTProfile : public ANTDevice
+{
+public:
+    ANTProfile(ANTTransmitter *tx, const unsigned char channel, unsigned short deviceId) :
+        m_tx(tx),
+        m_channel(channel),
+        m_deviceId(deviceId),
+        m_transmissionType(Profile::TransmissionType),
+        m_config(ChannelConfig::load(Profile::name(), Profile::Period, Profile::FixedPeriod,
+                                     Profile::pagePattern(), Profile::MainPageCount, Profile::CommonPageRepeat)),
+        m_period(m_config.period),
+        m_frequency(ANT_SPORT_FREQUENCY),
+        m_scheduler(m_config.pattern, m_config.mainCount, m_config.commonRepeat),
+        m_requestedPage(0),
+        m_requestRemaining(0),
+        m_requestAck(false),
+        m_requestUntilAck(false),
+        m_requestInFlight(false),
+        m_requestRetries(0)
+    {
+        m_page80 = ANTMessage::staticPage<ANTCommonPage80>(m_channel);
+        m_page81 = ANTMessage::staticPage<ANTCommonPage81>(m_channel);
+    }
+
+    int channel() const {return m_channel;}
+    unsigned short channelPeriod() const {return m_period;}
+    void setChannelPeriod(unsigned short period) {m_period = period;}
+    bool fixedChannelPeriod() const {return Profile::FixedPeriod;}
+    unsigned char channelFrequency() const {return m_frequency;}
+    void setChannelFrequency(unsigned char frequency) {if (!Profile::FixedFrequency) m_frequency = frequency;}
+    bool fixedChannelFrequency() const {return Profile::FixedFrequency;}
+
+    // upper nibble of the transmission type, extends the device number to 20 bits
+    void setDeviceNumberExtension(unsigned char extension)
+    {
+        m_transmissionType = (Profile::TransmissionType & 0x0F) | ((extension & 0x0F) << 4);
+    }
+
+    const ANTMessage &commonPage80() const {return m_page80;}
+    const ANTMessage &commonPage81() const {return m_page81;}
+
+    void channelEvent(unsigned char *ant_message)
+    {
+        // byte 0 sync
+        // byte 1 len
+        // byte 2 type (channel event 0x40 if we get it here)
+        // byte 3 channel number
+        // byte 4 message id (1 for RF events)
+        // byte 5 message code
+
+        if (! (ant_message[2] == ANT_CHANNEL_EVENT))
+        {
+            qDebug() << Profile::name() << "channelEvent() called with wrong message type";
+            return;
+        }
+
+        // Make sure we're the right channel
+        if (! (ant_message[3] == m_channel))
+        {
+            qDebug() << Profile::name() << "channelEvent() called with wrong channel";
+            return;
+        }
+
+        // Make sure it's an RF event
+        if (! (ant_message[4] == 1))
+        {
+            qDebug() << Profile::name() << "channelEvent() called, but not RF event";
+            return;
+        }
+
+        switch (ant_message[5])
+        {
+        case EVENT_TX:
+            // the acknowledged reply is still going out, its transfer result
+            // sends the next page, only EVENT_TRANSFER_TX_FAILED resends it
+            if (!m_requestInFlight)
+                sendNextPage();
+            break;
+        case EVENT_TRANSFER_TX_COMPLETED:
+        case EVENT_TRANSFER_TX_FAILED:
+            if (m_requestInFlight)
+            {
+                // no EVENT_TX for this slot, so the next page goes out from here
+                requestTransferDone(ant_message[5] == EVENT_TRANSFER_TX_COMPLETED);
+                sendNextPage();
+            }
+            static_cast<Profile*>(this)->handleChannelEvent(ant_message[5]);
+            break;
+        default:
+            static_cast<Profile*>(this)->handleChannelEvent(ant_message[5]);
+            break;
+        }
+    }
+
+    void handleAckData(unsigned char *ant_message)
+    {
+        // byte 0 sync
+        // byte 1 len
+        // byte 2 type (acknowledged data 0x4F if we get it here)
+        // byte 3 channel number
+        // byte 4 page
+
+        if (! (ant_message[2] == ANT_ACK_DATA))
+        {
+            qDebug() << Profile::name() << "handleAckData() called with wrong message type";
+            return;
+        }
+
+        // Make sure we're the right channel
+        if (! (ant_message[3] == m_channel))
+        {
+            qDebug() << Profile::name() << "handleAckData() called with wrong channel";
+            return;
+        }
+
+        if (ant_message[4] == ANT_PAGE_REQUEST)
+        {
+            handlePageRequest(ant_message + 4);
+            return;
+        }
+
+        static_cast<Profile*>(this)->handleAckPage(ant_message);
+    }
+
+    // Common page 70, bytes 1-2 slave serial, 3-4 descriptors, 5 requested
+    // transmission response, 6 page, 7 command type
+    void handlePageRequest(const unsigned char *request)
+    {
+        const unsigned char page = request[6];
+        const unsigned char commandType = request[7];
+        const bool ack = request[5] & 0x80;
+        const int count = request[5] & 0x7F;
+
+        if (commandType != 1) // request data page
+        {
+            qDebug() << Profile::name() << "unsupported page request command" << commandType;
+            return;
+        }
+
+        if (count == 0 && !ack)
+        {
+            qDebug() << Profile::name() << "page request for" << page << "with no transmissions";
+            return;
+        }
+
+        if (!static_cast<Profile*>(this)->requestedPage(page))
+        {
+            qDebug() << Profile::name() << "unhandled request for page" << page;
+            return;
+        }
+
+        // 0x80 means until acknowledged, which is once with ack and more retries
+        m_requestedPage = page;
+        m_requestRemaining = count ? count : 1;
+        m_requestAck = ack;
+        m_requestUntilAck = count == 0;
+        m_requestInFlight = false;
+        m_requestRetries = 0;
+    }
+
+    void sendNextPage()
+    {
+        if (m_requestRemaining > 0)
+        {
+            sendRequestedPage();
+            return;
+        }
+
+        const ANTMessage *m;
+        const int page = m_scheduler.nextPage();
+
+        switch (page)
+        {
+        case 80:
+            m = &m_page80;
+            break;
+        case 81:
+            m = &m_page81;
+            break;
+        default:
+            m = &static_cast<Profile*>(this)->encodePage(page);
+            break;
+        }
+
+        m_tx->send(*m, ANTTransmitter::Broadcast);
+    }
+
+    void configureChannel()
+    {
+        ANTMessage assignCh = ANTMessage::assignChannel(m_channel, 0x10, Profile::Network);
+        m_tx->send(assignCh, ANTTransmitter::Command);
+
+        ANTMessage id = ANTMessage::setChannelID(m_channel, m_deviceId, Profile::DeviceType, m_transmissionType);
+        m_tx->send(id, ANTTransmitter::Command);
+
+        ANTMessage chanPeriod = ANTMessage::setChannelPeriod(m_channel, m_period);
+        m_tx->send(chanPeriod, ANTTransmitter::Command);
+
+        ANTMessage chanFreq = ANTMessage::setChannelFreq(m_channel, m_frequency);
+        m_tx->send(chanFreq, ANTTransmitter::Command);
+
+        ANTMessage openChan = ANTMessage::open(m_channel);
+        m_tx->send(openChan, ANTTransmitter::Command);
+    }
+
+    // Defaults, a profile hides these with its own versions when needed
+    void handleChannelEvent(unsigned char code)
+    {
+        switch (code)
+        {
+        case RESPONSE_NO_ERROR:
+            qDebug() << Profile::name() << "RESPONSE_NO_ERROR";
+            break;
+        case EVENT_RX_SEARCH_TIMEOUT:
+            qDebug() << Profile::name() << "EVENT_RX_SEARCH_TIMEOUT";
+            break;
+        case EVENT_RX_FAIL:
+            qDebug() << Profile::name() << "EVENT_RX_FAIL";
+            break;
+        case EVENT_TRANSFER_RX_FAILED:
+            qDebug() << Profile::name() << "EVENT_TRANSFER_RX_FAILED";
+            break;
+        case EVENT_TRANSFER_TX_COMPLETED:
+            qDebug() << Profile::name() << "EVENT_TRANSFER_TX_COMPLETED";
+            break;
+        case EVENT_TRANSFER_TX_FAILED:
+            qDebug() << Profile::name() << "EVENT_TRANSFER_TX_FAILED";
+            break;
+        case EVENT_CHANNEL_COLLISION:
+            qDebug() << Profile::name() << "EVENT_CHANNEL_COLLISION";
+            break;
+        default:
+            // There's a lot not handled yet here
+            qDebug() << Profile::name() << "unhandled channel event" << code;
+            break;
+        }
+    }
+
+    void handleAckPage(unsigned char *ant_message)
+    {
+        qDebug() << Profile::name() << "Unhandled ack page" << ant_message[4];
+    }
+
+    // Current contents of a page a peer may ask for, 0 if it can't be sent
+    const ANTMessage *requestedPage(int page)
+    {
+        switch (page)
+        {
+        case 80:
+            return &m_page80;
+        case 81:
+            return &m_page81;
+        default:
+            return 0;
+        }
+    }
+
+protected:
+    void sendRequestedPage()
+    {
+        const ANTMessage *page = static_cast<Profile*>(this)->requestedPage(m_requestedPage);
+        if (!page)
+        {
+            m_requestRemaining = 0;
+            return;
+        }
+
+        if (!m_requestAck)
+        {
+            m_requestRemaining--;
+            m_tx->send(*page, ANTTransmitter::Broadcast);
+            return;
+        }
+
+        // must not go stale in the queue, its transfer result is waited for
+        ANTMessage m = *page;
+        m.setMessageId(ANT_ACK_DATA);
+        m_requestInFlight = true;
+        m_tx->send(m, ANTTransmitter::Command);
+    }
+
+    void requestTransferDone(bool completed)
+    {
+        m_requestInFlight = false;
+
+        if (completed)
+        {
+            m_requestRemaining--;
+            m_requestRetries = 0;
+        }
+        else if (++m_requestRetries > (m_requestUntilAck ? ANT_PAGE_REQUEST_UNTIL_ACK_RETRIES : ANT_PAGE_REQUEST_RETRIES))
+        {
+            qDebug() << Profile::name() << "giving up on requested page" << m_requestedPage << "after"
+                     << m_requestRetries - 1 << "retries";
+            m_requestRemaining = 0;
+        }
+    }
+
+    ANTTransmitter *m_tx;
+    unsigned char m_channel;
+    unsigned short m_deviceId;
+    unsigned char m_transmissionType;
+    const ChannelConfig m_config;
+    unsigned short m_period;
+    unsigned char m_frequency;
+    PageScheduler m_scheduler;
+    ANTMessage m_page80;
+    ANTMessage m_page81;
+
+    // outstanding page request, one at a time, a new request replaces it
+    unsigned char m_requestedPage;
+    int m_requestRemaining;
+    bool m_requestAck;
+    bool m_requestUntilAck; // 0x80 transmissions
+    bool m_requestInFlight;
+    int m_requestRetries;
+};
+
+#endif // ANTPROFILE_H
@@ -0,0 +1,561 @@
+/*
+ * Copyright (c) 2009 Mark Rages
+ * Copyright (c) 2011 Mark Liversedge (liversedge@gmail.com)
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "antstick.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include "antmessage.h"
+#include "transmitplanner.h"
+#include "anttrace.h"
+#include "telemetrydevice.h"
+#include "rfsurvey.h"
+
+// log link quality every this many transmissions on a channel (5 minutes at 4Hz)
+#define LINK_REPORT_INTERVAL 1200
+
+// the survey borrows the scan channel, which is otherwise the collector's
+#define RF_SURVEY_CHANNEL 0
+
+// report a private channel once more than this share of its slots collide
+#define RF_COLLISION_THRESHOLD 0.02
+
+ANTStick::ANTStick(const QString &id, int index, ANTTransport *transport, QObject *parent) : QThread(parent),
+    m_id(id),
+    m_index(index),
+    m_transport(transport),
+    m_tx(0),
+    m_maxChannels(ANT_DEFAULT_CHANNELS),
+    m_maxNetworks(ANT_DEFAULT_NETWORKS),
+    m_capabilitiesKnown(false),
+    m_nextChannel(1),
+    m_readErrors(0),
+    m_lost(false),
+    m_lostRequested(false),
+    m_txPower(index),
+    m_state(ST_WAIT_FOR_SYNC)
+{
+    if (!m_transport)
+        m_transport = new LibUsb(TYPE_ANT);
+
+    m_tx = new ANTTransmitter(m_transport);
+}
+
+ANTStick::~ANTStick()
+{
+    m_tx->setLinkUp(false);
+    m_tx->stop();
+    delete m_tx;
+
+    // the writer is gone, nothing uses the handle any more
+    delete m_transport;
+}
+
+bool ANTStick::open()
+{
+    if (m_transport->open(m_id) < 0)
+    {
+        qDebug() << "ANTStick: failed to open stick" << m_id;
+        return false;
+    }
+
+    // all writes from here on go through the transmit queue
+    m_tx->setLinkUp(true);
+    m_tx->start(QThread::HighPriority);
+
+    // a replay's own capabilities reply comes through the receive loop with the rest
+    if (m_transport->replay())
+        return true;
+
+    if (!requestCapabilities())
+        qDebug() << "ANTStick" << m_id << "no capabilities reply, assuming" << m_maxChannels << "channels";
+
+    return true;
+}
+
+bool ANTStick::reattach(const QString &id)
+{
+    // the stick thread is parked in run() until we release it
+    m_id = id;
+    m_capabilitiesKnown = false;
+    if (!open())
+        return false;
+
+    m_lost.store(false);
+    m_reattached.release();
+    return true;
+}
+
+void ANTStick::run()
+{
+    configure();
+
+    while(1)
+    {
+        if (!readStick() || m_tx->linkLost() || m_lostRequested.load())
+        {
+            teardown();
+
+            // ANT reopens the stick when it shows up again
+            m_reattached.acquire();
+
+            qDebug() << "ANTStick" << m_index << "back as" << m_id << ", reconfiguring";
+            configure();
+        }
+    }
+}
+
+void ANTStick::teardown()
+{
+    qDebug() << "ANTStick" << m_index << m_id << "lost, closing";
+
+    // stop the writer before the handle goes away, open() restarts it
+    m_tx->setLinkUp(false);
+    m_tx->stop();
+    m_transport->close();
+
+    TransmitPlanner::instance()->removeStick(m_index);
+
+    m_state = ST_WAIT_FOR_SYNC;
+    m_readErrors = 0;
+    // lost before the request is cleared, so ANT never sees neither
+    m_lost.store(true);
+    m_lostRequested.store(false);
+
+    emit linkLost();
+}
+
+void ANTStick::configure()
+{
+    const unsigned char key[8] = { 0xB9, 0xA5, 0x21, 0xFB, 0xBD, 0x72, 0xC3, 0x45 };
+
+    // Set ANT+ network key for network 0
+    ANTMessage mess = ANTMessage::setNetworkKey(0, key);
+    m_tx->send(mess, ANTTransmitter::Command);
+
+#ifdef ENABLE_ANT_TELEMETRY
+    // and our private key for the telemetry channel
+    unsigned char telemetryKey[ANT_KEY_LENGTH];
+    if (TELEMETRY_NETWORK < m_maxNetworks && TelemetryDevice::networkKey(telemetryKey))
+    {
+        ANTMessage privateKey = ANTMessage::setNetworkKey(TELEMETRY_NETWORK, telemetryKey);
+        m_tx->send(privateKey, ANTTransmitter::Command);
+    }
+#endif
+
+    // have the stick append channel id, rssi and its receive time to all received data
+    ANTMessage libConfig = ANTMessage::setLibConfig(ANT_EXT_FLAG_CHANNEL_ID | ANT_EXT_FLAG_RSSI | ANT_EXT_FLAG_TIMESTAMP);
+    m_tx->send(libConfig, ANTTransmitter::Command);
+
+    msleep(100);
+
+    QMap<int, ANTDevice*> devices;
+    {
+        QMutexLocker locker(&m_devicesMutex);
+        devices = m_devices;
+    }
+
+    surveyFrequencies(devices);
+
+    // one level for the whole stick
+    if (m_txPower.enabled())
+    {
+        ANTMessage txPower = ANTMessage::setTxPower(m_txPower.level());
+        m_tx->send(txPower, ANTTransmitter::Command);
+    }
+
+    foreach (ANTDevice* antdev, devices)
+    {
+        // open each transmitting channel in its own slot to keep them from colliding
+        if (antdev->channelPeriod())
+        {
+            TransmitPlanner *planner = TransmitPlanner::instance();
+            antdev->setChannelPeriod(planner->addChannel(m_index, antdev->channel(), antdev->channelPeriod(), antdev->fixedChannelPeriod()));
+            msleep(planner->openDelay(m_index, antdev->channel()));
+        }
+        antdev->configureChannel();
+    }
+}
+
+bool ANTStick::readStick()
+{
+    // read more bytes from the device
+    uint8_t byte;
+    const int rc = m_transport->read((char *)&byte, 1);
+
+    ANTTrace::pollDumpRequest();
+
+    if (rc > 0)
+    {
+        m_readErrors = 0;
+        receiveByte((unsigned char)byte);
+        return true;
+    }
+
+    if (rc < 0 && LibUsb::isFatalError(rc) && ++m_readErrors >= 3)
+        return false;
+
+    msleep(5);
+    return true;
+}
+
+bool ANTStick::requestCapabilities()
+{
+    ANTMessage request = ANTMessage::requestMessage(0, ANT_CAPABILITIES);
+    m_tx->send(request, ANTTransmitter::Command);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!m_capabilitiesKnown && timer.elapsed() < 1000)
+    {
+        readStick();
+    }
+
+    return m_capabilitiesKnown;
+}
+
+void ANTStick::listen(int ms)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms)
+    {
+        readStick();
+    }
+}
+
+void ANTStick::surveyFrequencies(const QMap<int, ANTDevice*> &devices)
+{
+    QList<ANTDevice*> movable;
+    foreach (ANTDevice* antdev, devices)
+    {
+        if (!antdev->fixedChannelFrequency())
+            movable.append(antdev);
+    }
+
+    // Once per stick, a reattach shouldn't hold up the reconnect for
+    // another survey
+    if (movable.isEmpty() || !m_frequencyRanking.isEmpty())
+        return;
+
+    foreach (ANTDevice* antdev, movable)
+    {
+        FrequencyWindow &window = m_frequencyWindows[antdev->channel()];
+        window.txSlots = txSlots(antdev->channel());
+        window.collisions = m_stats.value(antdev->channel(), ANTLinkStats::Collisions);
+        window.previousRate = 0;
+    }
+
+    // scanning takes the whole radio, other clients of a shared stick have
+    // channels open, and a replay would lose its frames to the scan
+    if (devices.contains(RF_SURVEY_CHANNEL) || m_transport->shared() || m_transport->replay())
+        return;
+
+    // ANT+ traffic and the other bridges on our private key
+    QVector<unsigned char> networks;
+    networks << 0;
+    unsigned char key[ANT_KEY_LENGTH];
+    if (TELEMETRY_NETWORK < m_maxNetworks && TelemetryDevice::networkKey(key))
+        networks << TELEMETRY_NETWORK;
+
+    RFSurvey survey(m_tx, RF_SURVEY_CHANNEL);
+    addDevice(RF_SURVEY_CHANNEL, &survey);
+
+    foreach (unsigned char network, networks)
+    {
+        survey.start(network);
+        foreach (unsigned char frequency, RFSurvey::candidates())
+        {
+            survey.tune(frequency);
+            listen(RF_SURVEY_DWELL_MS);
+        }
+        survey.stop();
+
+        // let EVENT_CHANNEL_CLOSED through before the channel is assigned again
+        listen(100);
+    }
+
+    removeDevice(RF_SURVEY_CHANNEL);
+
+    m_frequencyRanking.clear();
+    foreach (const RFSurvey::Result &result, survey.results())
+    {
+        qDebug() << "ANTStick" << m_index << "RF survey" << 2400 + result.frequency << "MHz:"
+                 << result.packets << "packets, mean rssi" << result.meanRssi << "score" << result.score;
+        m_frequencyRanking.append(result.frequency);
+    }
+
+    // The frequency is pinned, a receiver has no way of following a move.
+    // The survey only tells what to pin both ends to.
+    const unsigned char frequency = movable.first()->channelFrequency();
+    qDebug() << "ANTStick" << m_index << "private channels on" << 2400 + frequency << "MHz, quietest was"
+             << 2400 + m_frequencyRanking.first() << "MHz";
+}
+
+quint64 ANTStick::txSlots(int channel) const
+{
+    // same accounting as ANTLinkStats::Snapshot::collisionRate()
+    return m_stats.value(channel, ANTLinkStats::TxEvents) + m_stats.value(channel, ANTLinkStats::Collisions)
+            + m_stats.value(channel, ANTLinkStats::TxCompleted) + m_stats.value(channel, ANTLinkStats::TxFailed);
+}
+
+void ANTStick::reviewFrequency(int channel)
+{
+    if (!m_frequencyWindows.contains(channel) || !m_devices.contains(channel))
+        return;
+
+    // collision rate since the last review, not since the stick was opened
+    FrequencyWindow &window = m_frequencyWindows[channel];
+    const quint64 sent = txSlots(channel);
+    const quint64 collisions = m_stats.value(channel, ANTLinkStats::Collisions);
+    const double rate = sent > window.txSlots ? double(collisions - window.collisions) / (sent - window.txSlots) : 0.0;
+    window.txSlots = sent;
+    window.collisions = collisions;
+
+    ANTDevice *antdev = m_devices[channel];
+
+    qDebug() << "ANTStick" << m_index << "channel" << channel << "collision rate" << 100.0 * window.previousRate
+             << "% ->" << 100.0 * rate << "% on" << 2400 + antdev->channelFrequency() << "MHz";
+    window.previousRate = rate;
+
+    // Receivers have no way of hearing about a move, so a busy frequency is
+    // reported with the quietest other one to pin both ends to instead
+    if (rate > RF_COLLISION_THRESHOLD)
+    {
+        int next = -1;
+        foreach (unsigned char frequency, m_frequencyRanking)
+        {
+            if (frequency != antdev->channelFrequency())
+            {
+                next = frequency;
+                break;
+            }
+        }
+
+        if (next >= 0)
+            qDebug() << "ANTStick" << m_index << "channel" << channel << "over" << 100.0 * RF_COLLISION_THRESHOLD
+                     << "% collisions, quieter to pin both ends to with ANT_TELEMETRY_FREQ:" << next;
+        else
+            qDebug() << "ANTStick" << m_index << "channel" << channel << "over" << 100.0 * RF_COLLISION_THRESHOLD
+                     << "% collisions";
+    }
+}
+
+int ANTStick::allocateChannel()
+{
+    // channel 0 is left for scanning, transmitting channels go from 1 and up
+    if (m_nextChannel >= m_maxChannels)
+        return -1;
+
+    return m_nextChannel++;
+}
+
+void ANTStick::addDevice(int channel, ANTDevice *device)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    m_devices[channel] = device;
+}
+
+void ANTStick::removeDevice(int channel)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    m_devices.remove(channel);
+}
+
+void ANTStick::receiveByte(unsigned char byte) {
+
+    switch (m_state) {
+    case ST_WAIT_FOR_SYNC:
+        if (byte == ANT_SYNC_BYTE) {
+            m_state = ST_GET_LENGTH;
+            checksum = ANT_SYNC_BYTE;
+            rxMessage[0] = byte;
+        }
+        else {
+            m_stats.count(ANTLinkStats::Resyncs);
+        }
+        break;
+
+    case ST_GET_LENGTH:
+        if ((byte == 0) || (byte > ANT_MAX_LENGTH)) {
+            m_stats.count(ANTLinkStats::Resyncs);
+            m_state = ST_WAIT_FOR_SYNC;
+        }
+        else {
+            rxMessage[ANT_OFFSET_LENGTH] = byte;
+            checksum ^= byte;
+            length = byte;
+            bytes = 0;
+            m_state = ST_GET_MESSAGE_ID;
+        }
+        break;
+
+    case ST_GET_MESSAGE_ID:
+        rxMessage[ANT_OFFSET_ID] = byte;
+        checksum ^= byte;
+        m_state = ST_GET_DATA;
+        break;
+
+    case ST_GET_DATA:
+        rxMessage[ANT_OFFSET_DATA + bytes] = byte;
+        checksum ^= byte;
+        if (++bytes >= length){
+            m_state = ST_VALIDATE_PACKET;
+        }
+        break;
+
+    case ST_VALIDATE_PACKET:
+        if (checksum == byte){
+            m_stats.count(ANTLinkStats::Frames);
+            processMessage();
+        }
+        else {
+            m_stats.count(ANTLinkStats::ChecksumErrors);
+        }
+        m_state = ST_WAIT_FOR_SYNC;
+        break;
+    }
+}
+
+void ANTStick::processMessage()
+{
+    ANTTrace::record(ANTTrace::Rx, rxMessage);
+
+    switch (rxMessage[ANT_OFFSET_ID]) {
+    case ANT_NOTIF_STARTUP:
+        break;
+    case ANT_ACK_DATA:
+    case ANT_BROADCAST_DATA:
+    case ANT_CHANNEL_STATUS:
+    case ANT_CHANNEL_ID:
+    case ANT_BURST_DATA:
+        handleChannelEvent();
+        break;
+
+    case ANT_CHANNEL_EVENT:
+        handleChannelEvent();
+        break;
+
+    case ANT_VERSION:
+        break;
+
+    case ANT_CAPABILITIES:
+        // byte 3 max channels
+        // byte 4 max networks
+        // byte 6 advanced options
+        m_maxChannels = qMin(int(rxMessage[ANT_OFFSET_DATA]), ANT_MAX_CHANNELS);
+        m_maxNetworks = rxMessage[ANT_OFFSET_DATA + 1];
+        m_capabilitiesKnown = true;
+        qDebug() << "ANT stick capabilities:" << m_maxChannels << "channels" << m_maxNetworks << "networks";
+        break;
+
+    case ANT_SERIAL_NUMBER:
+        break;
+
+    default:
+        break;
+    }
+}
+
+//
+// Pass inbound message to channel for handling
+//
+void ANTStick::handleChannelEvent(void) {
+    // masked once here, everything below goes by the channel passed down
+    int channel = rxMessage[ANT_OFFSET_CHANNEL_NUMBER] & ANT_CHANNEL_NUMBER_MASK;
+    if(channel >= 0 && channel < m_maxChannels) {
+
+        // handle a channel event here!
+        //antChannel[channel]->receiveMessage(rxMessage);
+        //qDebug() << "Channel event on channel: " << channel;
+        receiveChannelMessage(channel, rxMessage);
+    }
+}
+
+
+void ANTStick::receiveChannelMessage(int channel, unsigned char *ant_message)
+{
+    switch (ant_message[2]) {
+    case ANT_CHANNEL_EVENT:
+        if (ant_message[4] == 1)
+        {
+            m_stats.countEvent(channel, ant_message[5]);
+
+            if (ant_message[5] == EVENT_TX && m_stats.value(channel, ANTLinkStats::TxEvents) % LINK_REPORT_INTERVAL == 0)
+            {
+                ANTLinkStats::Snapshot s = m_stats.snapshot();
+                qDebug() << "ANTStick" << m_index << "channel" << channel << "collision rate"
+                         << 100.0 * s.collisionRate(channel) << "% checksum errors" << s.stick[ANTLinkStats::ChecksumErrors];
+
+                reviewFrequency(channel);
+            }
+        }
+        if (m_devices.contains(channel))
+        {
+            m_devices[channel]->channelEvent(ant_message);
+        }
+        break;
+    case ANT_BROADCAST_DATA:
+        m_stats.count(channel, ANTLinkStats::BroadcastsReceived);
+        if (m_devices.contains(channel))
+        {
+            m_devices[channel]->handleBroadcastData(ant_message);
+        }
+        break;
+    case ANT_ACK_DATA:
+        //ackEvent(ant_message);
+        m_stats.count(channel, ANTLinkStats::AcksReceived);
+        if (m_devices.contains(channel))
+        {
+            m_devices[channel]->handleAckData(ant_message);
+        }
+
+        break;
+    case ANT_CHANNEL_ID:
+        //channelId(ant_message);
+        qDebug()<<"Channel id";
+        break;
+    case ANT_BURST_DATA:
+        //burstData(ant_message);
+        qDebug() << "Channel burst data";
+        break;
+    default:
+        //qDebug()<<"dunno?"<<number;
+        break; //errors silently ignored for now, would indicate hardware fault.
+    }
+}
+
+void ANTStick::setCurrentPower(quint16 power)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    foreach (ANTDevice* antdev, m_devices)
+    {
+        antdev->setCurrentPower(power);
+    }
+}
+
+void ANTStick::setCurrentCadence(quint8 cadence)
+{
+    QMutexLocker locker(&m_devicesMutex);
+    foreach (ANTDevice* antdev, m_devices)
+    {
+        antdev->setCurrentCadence(cadence);
+    }
+}
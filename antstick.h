@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2009 Mark Rages
+ * Copyright (c) 2011 Mark Liversedge (liversedge@gmail.com)
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTSTICK_H
+#define ANTSTICK_H
+
+#include <QThread>
+#include <QString>
+#include <QMap>
+#include <QVector>
+#include <QMutex>
+#include <QSemaphore>
+#include <atomic>
+#include "LibUsb.h"
+#include "antmessage.h"
+#include "antdevice.h"
+#include "anttransmitter.h"
+#include "antlinkstats.h"
+#include "txpowercontroller.h"
+
+/*
+ * One ANT stick and everything that talks to it: its own transport,
+ * transmit queue, receive thread and the devices on its channels. ANT
+ * opens the stick, places devices on it and then starts the thread.
+ *
+ * When the stick stops answering, or ANT saw it unplugged, the thread
+ * closes the handle and waits for ANT to reattach it. The devices are
+ * kept as they were and their channels are configured again once the
+ * stick is back, so they carry on where they left off.
+ *
+ * Private channels don't have to sit on the ANT+ frequency, ANT_TELEMETRY_FREQ
+ * pins them elsewhere and receivers are set to the same. They never move on
+ * their own, a receiver can't follow. The first time they open, the stick
+ * surveys a few candidate frequencies on both the ANT+ and the private
+ * network and reports the quietest, and their collision rate is reported as
+ * they go along with a quieter frequency to pin to. A stick shared through
+ * ANTMux is never surveyed, the scan would take it from the other clients.
+ *
+ * Transmit power is set for the whole stick by a TxPowerController when
+ * ANT_TX_POWER asks for it.
+ */
+class ANTStick : public QThread
+{
+    Q_OBJECT
+public:
+    // without a transport the stick is a LibUsb one that scans the busses
+    // itself, either way the stick owns it
+    ANTStick(const QString &id, int index, ANTTransport *transport = 0, QObject *parent = 0);
+    ~ANTStick();
+
+    bool open(); // opens the stick and reads its capabilities (not on a replay), call before start()
+
+    bool isLost() const {return m_lost.load();}
+    void markLost() {m_lostRequested.store(true);}
+    bool teardownPending() const {return m_lostRequested.load() && !m_lost.load();} // marked, thread not done yet
+    bool reattach(const QString &id); // reopen a lost stick, possibly at a new address
+
+    QString id() const {return m_id;}
+    int index() const {return m_index;}
+    int maxChannels() const {return m_maxChannels;}
+    int maxNetworks() const {return m_maxNetworks;}
+    ANTTransmitter *transmitter() const {return m_tx;}
+    ANTLinkStats::Snapshot linkStats() const {return m_stats.snapshot();}
+
+    int allocateChannel(); // -1 when the stick is full
+    void addDevice(int channel, ANTDevice *device);
+
+    void setCurrentPower(quint16 power);
+    void setCurrentCadence(quint8 cadence);
+
+signals:
+    void linkLost(); // emitted on the stick's thread once the handle is closed
+
+private:
+    void run();
+    void configure();
+    bool readStick(); // false once the link is gone
+    void teardown();
+    bool requestCapabilities();
+    void listen(int ms); // read the stick for a while from within configure()
+    void removeDevice(int channel);
+    void surveyFrequencies(const QMap<int, ANTDevice*> &devices);
+    void reviewFrequency(int channel);
+    quint64 txSlots(int channel) const;
+
+    struct FrequencyWindow {
+        quint64 txSlots; // counters at the start of the window
+        quint64 collisions;
+        double previousRate;
+    };
+
+    QString m_id;
+    int m_index;
+    ANTTransport *m_transport;
+    ANTTransmitter *m_tx;
+    int m_maxChannels;
+    int m_maxNetworks;
+    bool m_capabilitiesKnown;
+    int m_nextChannel;
+    int m_readErrors;
+    std::atomic<bool> m_lost;
+    std::atomic<bool> m_lostRequested;
+    QSemaphore m_reattached;
+    ANTLinkStats m_stats;
+    TxPowerController m_txPower;
+    QMap<int, ANTDevice*> m_devices;
+    QVector<unsigned char> m_frequencyRanking; // quietest first, from the survey
+    QMap<int, FrequencyWindow> m_frequencyWindows;
+    QMutex m_devicesMutex; // the setters walk m_devices from the caller's thread
+
+    // state machine whilst receiving bytes
+    enum States {ST_WAIT_FOR_SYNC, ST_GET_LENGTH, ST_GET_MESSAGE_ID, ST_GET_DATA, ST_VALIDATE_PACKET} m_state;
+    void receiveByte(unsigned char byte);
+    void processMessage();
+    void handleChannelEvent();
+    void receiveChannelMessage(int channel, unsigned char *ant_message);
+
+    unsigned char rxMessage[ANT_MAX_MESSAGE_SIZE];
+
+    int length;
+    int bytes;
+    int checksum;
+};
+
+#endif // ANTSTICK_H
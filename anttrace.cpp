@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "anttrace.h"
+#include <QElapsedTimer>
+#include <QVector>
+#include <algorithm>
+
+std::atomic<int> ANTTrace::s_verbosity(ANTTrace::Off);
+std::atomic<ANTTrace::Ring*> ANTTrace::s_rings(0);
+std::atomic<int> ANTTrace::s_threads(0);
+volatile sig_atomic_t ANTTrace::s_dumpRequested = 0;
+
+static QElapsedTimer &traceClock()
+{
+    static QElapsedTimer clock;
+    return clock;
+}
+
+void ANTTrace::init()
+{
+    traceClock().start();
+
+    bool ok = false;
+    const int level = qgetenv("ANT_TRACE").toInt(&ok);
+    if (ok)
+        setVerbosity(qBound(int(Off), level, int(All)));
+
+#ifdef Q_OS_UNIX
+    signal(SIGUSR1, &ANTTrace::requestDump);
+#endif
+}
+
+void ANTTrace::requestDump(int signal)
+{
+    Q_UNUSED(signal);
+    s_dumpRequested = 1;
+}
+
+ANTTrace::Ring *ANTTrace::threadRing()
+{
+    static thread_local Ring *ring = 0;
+
+    if (!ring)
+    {
+        // first frame from this thread, rings live for the whole process
+        ring = new Ring;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->thread = s_threads.fetch_add(1, std::memory_order_relaxed);
+        ring->next = s_rings.load(std::memory_order_relaxed);
+        while (!s_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    return ring;
+}
+
+void ANTTrace::write(Direction direction, const unsigned char *frame)
+{
+    Ring *ring = threadRing();
+    const unsigned int head = ring->head.load(std::memory_order_relaxed);
+    Entry &entry = ring->entries[head & (ANT_TRACE_RING_SIZE - 1)];
+
+    // sync, length, id and data, the checksum was verified or computed already
+    const int length = qMin(frame[ANT_OFFSET_LENGTH] + 3, ANT_MAX_MESSAGE_SIZE);
+
+    entry.timestamp = traceClock().nsecsElapsed();
+    entry.direction = direction;
+    memcpy(entry.frame, frame, length);
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void ANTTrace::pollDumpRequest()
+{
+    if (!s_dumpRequested)
+        return;
+
+    s_dumpRequested = 0;
+    dump(stderr);
+}
+
+void ANTTrace::dump(FILE *out)
+{
+    struct Line {
+        Entry entry;
+        int thread;
+        bool operator<(const Line &other) const {return entry.timestamp < other.entry.timestamp;}
+    };
+
+    // copy out first, the newest entries of a busy ring may be mid-write
+    QVector<Line> lines;
+    for (Ring *ring = s_rings.load(std::memory_order_acquire); ring; ring = ring->next)
+    {
+        const unsigned int head = ring->head.load(std::memory_order_acquire);
+        const unsigned int count = qMin(head, (unsigned int)ANT_TRACE_RING_SIZE);
+
+        for (unsigned int i = head - count; i != head; ++i)
+        {
+            Line line;
+            line.entry = ring->entries[i & (ANT_TRACE_RING_SIZE - 1)];
+            line.thread = ring->thread;
+            lines.append(line);
+        }
+    }
+
+    std::sort(lines.begin(), lines.end());
+
+    fprintf(out, "ANT trace, %d frames, verbosity %d\n", lines.size(), verbosity());
+    foreach (const Line &line, lines)
+    {
+        const unsigned char *frame = line.entry.frame;
+        const int length = qMin(frame[ANT_OFFSET_LENGTH] + 3, ANT_MAX_MESSAGE_SIZE);
+
+        fprintf(out, "%10.6f t%d %s ", line.entry.timestamp / 1e9, line.thread, line.entry.direction == Rx ? "Recv:" : "Send:");
+        for (int i = 0; i < length; ++i)
+            fprintf(out, "[%02x]", frame[i]);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTTRACE_H
+#define ANTTRACE_H
+
+#include <QtGlobal>
+#include <cstdio>
+#include <csignal>
+#include <atomic>
+#include "antmessage.h"
+
+#define ANT_TRACE_RING_SIZE 1024 // frames per thread, must be a power of two
+
+/*
+ * Binary trace of the frames going to and from the stick. Each thread
+ * records into its own fixed-size ring, so recording is a copy and an
+ * index bump with no locking or formatting. Verbosity is picked at runtime
+ * with the ANT_TRACE environment variable or setVerbosity():
+ *
+ *   0  off
+ *   1  everything but the periodic traffic (broadcasts and EVENT_TX)
+ *   2  every frame
+ *
+ * The rings are formatted only when dumped, on SIGUSR1 or by calling dump().
+ */
+class ANTTrace
+{
+public:
+    enum Direction {Rx = 0, Tx = 1};
+    enum Verbosity {Off = 0, Events = 1, All = 2};
+
+    static void init();
+
+    static void setVerbosity(int verbosity) {s_verbosity.store(verbosity, std::memory_order_relaxed);}
+    static int verbosity() {return s_verbosity.load(std::memory_order_relaxed);}
+
+    static inline void record(Direction direction, const unsigned char *frame)
+    {
+        const int level = s_verbosity.load(std::memory_order_relaxed);
+        if (level == Off)
+            return;
+
+        if (level == Events && isPeriodic(frame))
+            return;
+
+        write(direction, frame);
+    }
+
+    // called from a thread that can afford the formatting, dumps if SIGUSR1 came in
+    static void pollDumpRequest();
+    static void dump(FILE *out);
+
+private:
+    struct Entry {
+        qint64 timestamp; // ns since init()
+        unsigned char direction;
+        unsigned char frame[ANT_MAX_MESSAGE_SIZE];
+    };
+
+    struct Ring {
+        Entry entries[ANT_TRACE_RING_SIZE];
+        std::atomic<unsigned int> head;
+        int thread;
+        Ring *next;
+    };
+
+    static inline bool isPeriodic(const unsigned char *frame)
+    {
+        if (frame[ANT_OFFSET_ID] == ANT_BROADCAST_DATA)
+            return true;
+
+        return frame[ANT_OFFSET_ID] == ANT_CHANNEL_EVENT
+            && frame[ANT_OFFSET_MESSAGE_ID] == 1
+            && frame[ANT_OFFSET_MESSAGE_CODE] == EVENT_TX;
+    }
+
+    static void write(Direction direction, const unsigned char *frame);
+    static Ring *threadRing();
+    static void requestDump(int signal);
+
+    static std::atomic<int> s_verbosity;
+    static std::atomic<Ring*> s_rings;
+    static std::atomic<int> s_threads;
+    static volatile sig_atomic_t s_dumpRequested;
+};
+
+#endif // ANTTRACE_H
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "anttransmitter.h"
+#include "LibUsb.h"
+#include "anttrace.h"
+#include <QDebug>
+
+// log queue statistics this often
+#define ANT_TX_REPORT_INTERVAL 4800
+
+// upper bound on frames packed into one usb transfer
+#ifndef DISABLE_TX_COALESCING
+#define ANT_TX_TRANSFER_FRAMES ANT_TX_TRANSFER_SIZE
+#else
+#define ANT_TX_TRANSFER_FRAMES 1
+#endif
+
+ANTTransmitter::FrameQueue::FrameQueue() :
+    m_enqueuePos(0),
+    m_dequeuePos(0)
+{
+    for (unsigned int i = 0; i < ANT_TX_QUEUE_SIZE; ++i)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool ANTTransmitter::FrameQueue::push(const Frame &frame)
+{
+    unsigned int pos = m_enqueuePos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        Cell &cell = m_cells[pos & (ANT_TX_QUEUE_SIZE - 1)];
+        const unsigned int sequence = cell.sequence.load(std::memory_order_acquire);
+        const int diff = int(sequence - pos);
+
+        if (diff == 0)
+        {
+            // cell is free, claim the position
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.frame = frame;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // consumer hasn't got this far yet, queue is full
+            return false;
+        }
+        else
+        {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool ANTTransmitter::FrameQueue::pop(Frame &frame)
+{
+    Cell &cell = m_cells[m_dequeuePos & (ANT_TX_QUEUE_SIZE - 1)];
+    const unsigned int sequence = cell.sequence.load(std::memory_order_acquire);
+
+    if (int(sequence - (m_dequeuePos + 1)) < 0)
+        return false;
+
+    frame = cell.frame;
+    cell.sequence.store(m_dequeuePos + ANT_TX_QUEUE_SIZE, std::memory_order_release);
+    m_dequeuePos++;
+    return true;
+}
+
+ANTTransmitter::ANTTransmitter(ANTTransport *transport, QObject *parent) : QThread(parent),
+    m_transport(transport),
+    m_commandSlots(ANT_TX_QUEUE_SIZE),
+    m_stop(false),
+    m_linkUp(true),
+    m_linkLost(false),
+    m_writing(false),
+    m_writeTimeouts(0),
+    m_queued(0),
+    m_written(0),
+    m_transfers(0),
+    m_droppedFull(0),
+    m_droppedStale(0),
+    m_droppedOffline(0),
+    m_depth(0),
+    m_maxDepth(0),
+    m_totalWaitNs(0),
+    m_maxWaitNs(0)
+{
+    for (int i = 0; i < ANT_TX_CHANNEL_SLOTS; ++i)
+        m_generation[i].store(0, std::memory_order_relaxed);
+
+    m_clock.start();
+}
+
+bool ANTTransmitter::send(const ANTMessage &message, Priority priority)
+{
+    Frame frame;
+    memcpy(frame.data, message.data, message.length);
+    frame.length = message.length;
+    frame.channel = message.data[ANT_OFFSET_CHANNEL_NUMBER] % ANT_TX_CHANNEL_SLOTS;
+    frame.generation = 0;
+    frame.priority = priority;
+    frame.enqueued = m_clock.nsecsElapsed();
+
+    // a channel's broadcasts come from one thread, so only it bumps the generation
+    if (priority == Broadcast)
+        frame.generation = m_generation[frame.channel].load(std::memory_order_relaxed) + 1;
+
+    // commands and replies must get through, wait for the writer to make
+    // room unless there's no link to write them to
+    if (priority == Command)
+    {
+        while (!m_commandSlots.tryAcquire(1, ANT_TX_STALE_MS))
+        {
+            if (!m_linkUp.load())
+            {
+                m_droppedOffline.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+    }
+
+    if (!m_queues[priority].push(frame))
+    {
+        m_droppedFull.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (priority == Broadcast)
+        m_generation[frame.channel].store(frame.generation, std::memory_order_relaxed);
+
+    const int depth = m_depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    int maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+    while (depth > maxDepth && !m_maxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed))
+        ;
+
+    m_queued.fetch_add(1, std::memory_order_relaxed);
+    m_pending.release();
+    return true;
+}
+
+bool ANTTransmitter::isStale(const Frame &frame, Priority priority, qint64 now) const
+{
+    if (priority != Broadcast)
+        return false;
+
+    // superseded by a newer broadcast on the same channel
+    if (int(m_generation[frame.channel].load(std::memory_order_relaxed) - frame.generation) > 0)
+        return true;
+
+    return (now - frame.enqueued) > qint64(ANT_TX_STALE_MS) * 1000000;
+}
+
+void ANTTransmitter::run()
+{
+    Frame frame;
+    bool carried = false; // popped for the last transfer but didn't fit in it
+    unsigned char transfer[ANT_TX_TRANSFER_SIZE];
+
+    while (!m_stop.load())
+    {
+        int length = 0;
+        int frames = 0;
+
+        if (!carried)
+            m_pending.acquire();
+
+        // each pending count is one frame, keep taking them while they fit
+        for (;;)
+        {
+            if (carried)
+                carried = false;
+            else if (!pop(frame))
+                break;
+
+            const qint64 now = m_clock.nsecsElapsed();
+            if (isStale(frame, frame.priority, now))
+            {
+                m_droppedStale.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (length + frame.length > ANT_TX_TRANSFER_SIZE)
+            {
+                carried = true;
+                break;
+            }
+            else
+            {
+                const qint64 wait = now - frame.enqueued;
+                m_totalWaitNs.fetch_add(wait, std::memory_order_relaxed);
+                if (wait > m_maxWaitNs.load(std::memory_order_relaxed))
+                    m_maxWaitNs.store(wait, std::memory_order_relaxed);
+
+                memcpy(transfer + length, frame.data, frame.length);
+                length += frame.length;
+                frames++;
+            }
+
+            if (frames >= ANT_TX_TRANSFER_FRAMES || m_stop.load())
+                break;
+
+            // only a part filled transfer is worth holding back for
+            if (!m_pending.tryAcquire(1, frames ? ANT_TX_COALESCE_MS : 0))
+                break;
+        }
+
+        if (frames)
+            writeTransfer(transfer, length, frames);
+    }
+}
+
+bool ANTTransmitter::pop(Frame &frame)
+{
+    for (int p = Command; p < PriorityCount; ++p)
+    {
+        if (m_queues[p].pop(frame))
+        {
+            m_depth.fetch_sub(1, std::memory_order_relaxed);
+            if (p == Command)
+                m_commandSlots.release();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ANTTransmitter::writeTransfer(const unsigned char *transfer, int length, int frames)
+{
+    m_writing.store(true);
+    if (!m_linkUp.load())
+    {
+        m_writing.store(false);
+        m_droppedOffline.fetch_add(frames, std::memory_order_relaxed);
+        return;
+    }
+
+    for (int offset = 0; offset < length; offset += transfer[offset + ANT_OFFSET_LENGTH] + 4)
+        ANTTrace::record(ANTTrace::Tx, transfer + offset);
+
+    const int rc = m_transport->write((char *)transfer, length);
+    m_writing.store(false);
+
+    if (rc < 0)
+    {
+        if (LibUsb::isFatalError(rc) || m_writeTimeouts.fetch_add(1) + 1 >= ANT_TX_MAX_TIMEOUTS)
+            m_linkLost.store(true);
+    }
+    else
+    {
+        m_writeTimeouts = 0;
+    }
+
+    m_transfers.fetch_add(1, std::memory_order_relaxed);
+    const quint64 written = m_written.fetch_add(frames, std::memory_order_relaxed);
+    if (written / ANT_TX_REPORT_INTERVAL != (written + frames) / ANT_TX_REPORT_INTERVAL)
+    {
+        Stats s = stats();
+        qDebug() << "ANTTransmitter: written" << s.written << "in" << s.transfers << "transfers"
+                 << "dropped full/stale" << s.droppedFull << s.droppedStale
+                 << "max depth" << s.maxDepth << "wait avg/max us" << s.averageWaitUs << s.maxWaitUs;
+    }
+}
+
+void ANTTransmitter::setLinkUp(bool up)
+{
+    if (up)
+    {
+        m_writeTimeouts = 0;
+        m_linkLost.store(false);
+        m_linkUp.store(true);
+        return;
+    }
+
+    m_linkUp.store(false);
+
+    // the writer either saw the link down or we see it writing
+    while (m_writing.load())
+        QThread::yieldCurrentThread();
+}
+
+void ANTTransmitter::stop()
+{
+    m_stop.store(true);
+    m_pending.release();
+    wait();
+    m_stop.store(false);
+
+    // nothing is reading the queues now, what's left was for the old link
+    Frame frame;
+    while (pop(frame))
+        m_droppedOffline.fetch_add(1, std::memory_order_relaxed);
+    while (m_pending.tryAcquire())
+        ;
+}
+
+ANTTransmitter::Stats ANTTransmitter::stats() const
+{
+    Stats s;
+    s.queued = m_queued.load(std::memory_order_relaxed);
+    s.written = m_written.load(std::memory_order_relaxed);
+    s.transfers = m_transfers.load(std::memory_order_relaxed);
+    s.droppedFull = m_droppedFull.load(std::memory_order_relaxed);
+    s.droppedStale = m_droppedStale.load(std::memory_order_relaxed);
+    s.droppedOffline = m_droppedOffline.load(std::memory_order_relaxed);
+    s.depth = m_depth.load(std::memory_order_relaxed);
+    s.maxDepth = m_maxDepth.load(std::memory_order_relaxed);
+    s.averageWaitUs = s.written ? m_totalWaitNs.load(std::memory_order_relaxed) / qint64(s.written) / 1000 : 0;
+    s.maxWaitUs = m_maxWaitNs.load(std::memory_order_relaxed) / 1000;
+    return s;
+}
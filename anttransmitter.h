@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTTRANSMITTER_H
+#define ANTTRANSMITTER_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QElapsedTimer>
+#include <atomic>
+#include "antmessage.h"
+
+class ANTTransport;
+
+#define ANT_TX_QUEUE_SIZE    64 // per priority, must be a power of two
+#define ANT_TX_CHANNEL_SLOTS 16
+#define ANT_TX_STALE_MS      250 // a broadcast older than this has missed its slot
+#define ANT_TX_MAX_TIMEOUTS  8 // consecutive write timeouts before the link counts as lost
+#define ANT_TX_TRANSFER_SIZE 64 // one usb bulk transfer, frames go in it back to back
+#define ANT_TX_COALESCE_MS   1 // how long a part filled transfer waits for more frames
+
+/*
+ * Owns all writes to the stick. Any thread queues frames with send(), which
+ * never blocks for broadcasts and only blocks commands while their queue is
+ * full and the link is up, and a writer thread drains them highest
+ * priority first. A broadcast is dropped instead of written when a newer one
+ * for the same channel is already queued or when it has waited too long, the
+ * next EVENT_TX will produce a fresh one anyway.
+ *
+ * Frames queued close together, from any channel, are packed into a single
+ * usb transfer so a burst of channel setup or several channels transmitting
+ * at once cost one write instead of one each.
+ */
+class ANTTransmitter : public QThread
+{
+    Q_OBJECT
+public:
+    enum Priority {Command = 0, Broadcast = 1, Diagnostic = 2, PriorityCount = 3};
+
+    struct Stats {
+        quint64 queued;
+        quint64 written;
+        quint64 transfers;
+        quint64 droppedFull;
+        quint64 droppedStale;
+        quint64 droppedOffline;
+        int depth;
+        int maxDepth;
+        qint64 averageWaitUs;
+        qint64 maxWaitUs;
+    };
+
+    explicit ANTTransmitter(ANTTransport *transport, QObject *parent = 0);
+
+    bool send(const ANTMessage &message, Priority priority);
+    Stats stats() const;
+
+    // Joins the writer thread and drops whatever is still queued, start()
+    // brings it back.
+    void stop();
+
+    // While the link is down frames are dropped instead of written. Taking
+    // it down waits for a write in progress, so the usb handle can be
+    // closed right after.
+    void setLinkUp(bool up);
+    bool linkLost() const {return m_linkLost.load();}
+
+private:
+    struct Frame {
+        unsigned char data[ANT_MAX_MESSAGE_SIZE+1];
+        unsigned char length;
+        unsigned char channel;
+        quint32 generation;
+        qint64 enqueued; // ns on m_clock
+        Priority priority;
+    };
+
+    // Bounded lock-free queue, many producers and the writer thread as the
+    // only consumer. Each cell's sequence tells whether it's free for the
+    // producer at that position or holds a frame for the consumer.
+    class FrameQueue
+    {
+    public:
+        FrameQueue();
+        bool push(const Frame &frame);
+        bool pop(Frame &frame);
+    private:
+        struct Cell {
+            std::atomic<unsigned int> sequence;
+            Frame frame;
+        };
+        Cell m_cells[ANT_TX_QUEUE_SIZE];
+        std::atomic<unsigned int> m_enqueuePos;
+        unsigned int m_dequeuePos;
+    };
+
+    void run();
+    bool pop(Frame &frame);
+    void writeTransfer(const unsigned char *transfer, int length, int frames);
+    bool isStale(const Frame &frame, Priority priority, qint64 now) const;
+
+    ANTTransport *m_transport;
+    QElapsedTimer m_clock;
+    QSemaphore m_pending;
+    QSemaphore m_commandSlots; // free cells in the Command queue
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_linkUp;
+    std::atomic<bool> m_linkLost; // a write failed in a way retrying won't fix
+    std::atomic<bool> m_writing;
+    std::atomic<int> m_writeTimeouts;
+    FrameQueue m_queues[PriorityCount];
+    std::atomic<quint32> m_generation[ANT_TX_CHANNEL_SLOTS];
+
+    std::atomic<quint64> m_queued;
+    std::atomic<quint64> m_written;
+    std::atomic<quint64> m_transfers;
+    std::atomic<quint64> m_droppedFull;
+    std::atomic<quint64> m_droppedStale;
+    std::atomic<quint64> m_droppedOffline;
+    std::atomic<int> m_depth;
+    std::atomic<int> m_maxDepth;
+    std::atomic<qint64> m_totalWaitNs;
+    std::atomic<qint64> m_maxWaitNs;
+};
+
+#endif // ANTTRANSMITTER_H
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ANTTRANSPORT_H
+#define ANTTRANSPORT_H
+
+#include <QString>
+
+/*
+ * Byte pipe to an ANT stick. read() and write() follow the libusb-0.1
+ * conventions LibUsb always had: byte count on success, -errno on failure,
+ * and read() gives up with -ETIMEDOUT after about 125ms without data.
+ * read() is called from the stick's thread and write() from its writer
+ * thread, so an implementation must allow the two at once.
+ */
+class ANTTransport
+{
+public:
+    virtual ~ANTTransport() {}
+
+    virtual int open(const QString &stickId) = 0;
+    virtual void close() = 0;
+    virtual int read(char *buf, int bytes) = 0;
+    virtual int write(char *buf, int bytes) = 0;
+
+    // other processes have channels open on the same stick
+    virtual bool shared() const {return false;}
+
+    // plays back a capture, a frame read anywhere but the receive loop is lost to the devices
+    virtual bool replay() const {return false;}
+};
+
+#endif // ANTTRANSPORT_H
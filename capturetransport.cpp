@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "capturetransport.h"
+#include <QDebug>
+#include <errno.h>
+
+// adds byte to a frame being put together, true once the frame is whole
+static bool collect(unsigned char *frame, int &count, unsigned char byte)
+{
+    if (count == 0 && byte != ANT_SYNC_BYTE)
+        return false;
+
+    if (count == ANT_OFFSET_LENGTH && (byte == 0 || byte > ANT_MAX_LENGTH))
+    {
+        count = 0;
+        return false;
+    }
+
+    frame[count++] = byte;
+
+    if (count < 4 || count < frame[ANT_OFFSET_LENGTH] + 4)
+        return false;
+
+    count = 0;
+    return true;
+}
+
+CaptureTransport::CaptureTransport(ANTTransport *transport, ANTCaptureWriter *writer, int stick) :
+    m_transport(transport),
+    m_writer(writer),
+    m_stick(stick),
+    m_rxCount(0),
+    m_txCount(0)
+{
+}
+
+CaptureTransport::~CaptureTransport()
+{
+    delete m_transport;
+}
+
+int CaptureTransport::open(const QString &stickId)
+{
+    m_rxCount = 0;
+    m_txCount = 0;
+    return m_transport->open(stickId);
+}
+
+void CaptureTransport::close()
+{
+    m_transport->close();
+}
+
+int CaptureTransport::read(char *buf, int bytes)
+{
+    const int rc = m_transport->read(buf, bytes);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        if (collect(m_rxFrame, m_rxCount, buf[i]))
+            m_writer->record(ANTCaptureRecord::Rx, m_stick, m_rxFrame);
+    }
+
+    return rc;
+}
+
+int CaptureTransport::write(char *buf, int bytes)
+{
+    const int rc = m_transport->write(buf, bytes);
+
+    // only what the stick took
+    for (int i = 0; i < rc; ++i)
+    {
+        if (collect(m_txFrame, m_txCount, buf[i]))
+            m_writer->record(ANTCaptureRecord::Tx, m_stick, m_txFrame);
+    }
+
+    return rc;
+}
+
+ReplayTransport::ReplayTransport(const QString &path, int stick) :
+    m_path(path),
+    m_stick(stick),
+    m_opened(false),
+    m_done(false),
+    m_index(0),
+    m_frames(0)
+{
+    m_record.length = 0;
+}
+
+int ReplayTransport::open(const QString &stickId)
+{
+    Q_UNUSED(stickId);
+
+    // reopening carries on where the replay was
+    if (!m_opened && !m_reader.open(m_path))
+        return -ENOENT;
+
+    m_opened = true;
+    return 0;
+}
+
+void ReplayTransport::close()
+{
+}
+
+int ReplayTransport::read(char *buf, int bytes)
+{
+    if (!m_opened)
+        return -ENODEV;
+
+    while (m_index >= m_record.length)
+    {
+        if (m_done)
+            return -ETIMEDOUT;
+
+        if (!m_reader.next(m_record))
+        {
+            const qint64 elapsed = qMax(qint64(1), m_clock.nsecsElapsed());
+            qDebug() << "ReplayTransport: replayed" << m_frames << "frames in" << elapsed / 1000000 << "ms,"
+                     << m_frames * 1000000000.0 / elapsed << "frames/s";
+            m_done = true;
+            m_record.length = 0;
+            return -ETIMEDOUT;
+        }
+
+        if (m_record.direction != ANTCaptureRecord::Rx || m_record.stick != m_stick)
+        {
+            m_record.length = 0;
+            continue;
+        }
+
+        if (m_frames++ == 0)
+            m_clock.start();
+        m_index = 0;
+    }
+
+    const int count = qMin(bytes, m_record.length - m_index);
+    memcpy(buf, m_record.frame + m_index, count);
+    m_index += count;
+    return count;
+}
+
+int ReplayTransport::write(char *buf, int bytes)
+{
+    // the devices answer a stick that isn't there
+    Q_UNUSED(buf);
+    return bytes;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef CAPTURETRANSPORT_H
+#define CAPTURETRANSPORT_H
+
+#include <QElapsedTimer>
+#include "anttransport.h"
+#include "antcapture.h"
+
+/*
+ * Passes everything through to the real transport and hands each whole
+ * frame read or written to an ANTCaptureWriter, tagged with the stick.
+ */
+class CaptureTransport : public ANTTransport
+{
+public:
+    CaptureTransport(ANTTransport *transport, ANTCaptureWriter *writer, int stick); // owns transport
+    ~CaptureTransport();
+
+    int open(const QString &stickId);
+    void close();
+    int read(char *buf, int bytes);
+    int write(char *buf, int bytes);
+    bool shared() const {return m_transport->shared();}
+    bool replay() const {return m_transport->replay();}
+
+private:
+    ANTTransport *m_transport;
+    ANTCaptureWriter *m_writer;
+    int m_stick;
+
+    // frames come and go in pieces, each direction is only used by one thread
+    unsigned char m_rxFrame[ANT_MAX_MESSAGE_SIZE];
+    int m_rxCount;
+    unsigned char m_txFrame[ANT_MAX_MESSAGE_SIZE];
+    int m_txCount;
+};
+
+/*
+ * Plays back what one stick sent in a capture, as fast as it's read, and
+ * throws away whatever is written to it. Put behind an ANTStick the whole
+ * receive path, parser and device dispatch, runs on real traffic. The
+ * rate is logged once the capture runs out, reads time out after that.
+ */
+class ReplayTransport : public ANTTransport
+{
+public:
+    explicit ReplayTransport(const QString &path, int stick = 0);
+
+    int open(const QString &stickId);
+    void close();
+    int read(char *buf, int bytes);
+    int write(char *buf, int bytes);
+    bool replay() const {return true;}
+
+private:
+    QString m_path;
+    int m_stick;
+    ANTCaptureReader m_reader;
+    bool m_opened;
+    bool m_done;
+    ANTCaptureRecord m_record;
+    int m_index; // next byte of m_record to hand out
+    QElapsedTimer m_clock;
+    qint64 m_frames;
+};
+
+#endif // CAPTURETRANSPORT_H
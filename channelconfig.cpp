@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "channelconfig.h"
+#include <QByteArray>
+#include <QList>
+#include <QDebug>
+
+#define ANT_PERIOD_MIN 164 // about 200Hz
+
+static QByteArray configKey(const char *profileName)
+{
+    QByteArray key(profileName);
+    if (key.endsWith("Device"))
+        key.chop(6);
+    return key.toUpper();
+}
+
+static unsigned short configuredPeriod(const QByteArray &key, unsigned short period, bool fixedPeriod)
+{
+    const QByteArray value = qgetenv(("ANT_RATE_" + key).constData());
+    if (value.isEmpty())
+        return period;
+
+    bool ok = false;
+    const double rate = value.toDouble(&ok);
+    if (!ok || rate <= 0)
+    {
+        qDebug() << "ChannelConfig: ignoring ANT_RATE_" + key << value << ", expected a rate in Hz";
+        return period;
+    }
+
+    if (!fixedPeriod)
+    {
+        const int configured = qRound(32768 / rate);
+        if (configured < ANT_PERIOD_MIN || configured > 0xFFFF)
+        {
+            qDebug() << "ChannelConfig: ignoring ANT_RATE_" + key << value << ", out of range";
+            return period;
+        }
+        return configured;
+    }
+
+    // n times the profile's own rate, with the period dividing evenly
+    const double base = 32768.0 / period;
+    const int n = qRound(rate / base);
+    if (n < 1 || period % n || qAbs(n * base - rate) > 0.1)
+    {
+        qDebug() << "ChannelConfig: ignoring ANT_RATE_" + key << value << ", must be a whole multiple of"
+                 << base << "Hz";
+        return period;
+    }
+
+    return period / n;
+}
+
+ChannelConfig ChannelConfig::load(const char *profileName, unsigned short period, bool fixedPeriod,
+                                  const QVector<int> &pattern, int mainCount, int commonRepeat)
+{
+    const QByteArray key = configKey(profileName);
+
+    ChannelConfig config;
+    config.period = configuredPeriod(key, period, fixedPeriod);
+    config.pattern = pattern;
+    config.mainCount = mainCount;
+    config.commonRepeat = commonRepeat;
+
+    const QByteArray value = qgetenv(("ANT_PAGES_" + key).constData());
+    if (!value.isEmpty())
+    {
+        const QList<QByteArray> fields = value.split('/');
+        QVector<int> pages;
+        bool ok = true;
+
+        foreach (const QByteArray &page, fields[0].split(','))
+        {
+            const int p = page.toInt(&ok);
+            if (!ok || !(pattern.contains(p) || p == 80 || p == 81))
+            {
+                ok = false;
+                break;
+            }
+            pages.append(p);
+        }
+
+        // pages, main and common, nothing after that
+        if (fields.size() > 3)
+            ok = false;
+
+        int main = mainCount;
+        int common = commonRepeat;
+        if (ok && fields.size() > 1)
+            main = fields[1].toInt(&ok);
+        if (ok && fields.size() > 2)
+            common = fields[2].toInt(&ok);
+
+        if (ok && main > 0 && common >= 0)
+        {
+            config.pattern = pages;
+            config.mainCount = main;
+            config.commonRepeat = common;
+        }
+        else
+        {
+            qDebug() << "ChannelConfig: ignoring ANT_PAGES_" + key << value << ", pages must come from" << pattern
+                     << "or be 80/81";
+        }
+    }
+
+    qDebug() << "ChannelConfig:" << profileName << "period" << config.period << "pages" << config.pattern
+             << "main" << config.mainCount << "common" << config.commonRepeat;
+    return config;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef CHANNELCONFIG_H
+#define CHANNELCONFIG_H
+
+#include <QVector>
+
+/*
+ * Broadcast rate and page rotation of a master profile. The profile's own
+ * values are used unless the environment overrides them:
+ *
+ *   ANT_RATE_<KEY>=<Hz>                               ANT_RATE_FEC=8
+ *   ANT_PAGES_<KEY>=<page,page,...>[/main[/common]]   ANT_PAGES_FEC=25,16,25,17/128/2
+ *
+ * KEY is the profile name without "Device" in upper case, POWER, FEC or
+ * TELEMETRY. Profiles with a fixed period only run at whole multiples of
+ * their own rate, which is what the ANT+ profiles allow. The rotation may
+ * reorder and repeat the profile's own pages and 80/81, main and common
+ * are the counts PageScheduler takes.
+ */
+struct ChannelConfig
+{
+    unsigned short period; // 1/32768s
+    QVector<int> pattern;
+    int mainCount;
+    int commonRepeat;
+
+    static ChannelConfig load(const char *profileName, unsigned short period, bool fixedPeriod,
+                              const QVector<int> &pattern, int mainCount, int commonRepeat);
+};
+
+#endif // CHANNELCONFIG_H
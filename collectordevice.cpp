@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "collectordevice.h"
+#include "anttransmitter.h"
+#include <QDebug>
+
+#define DEVICE_TYPE_POWER 0x0B
+#define DEVICE_TYPE_FEC   0x11
+
+CollectorDevice::CollectorDevice(ANTTransmitter *tx, const unsigned char channel, QObject *parent) : QObject(parent),
+    m_tx(tx),
+    m_channel(channel),
+    m_rxTicks(-1),
+    m_lastRxTimestamp(0),
+    m_lastRxHostTime(0)
+{
+    m_timer.start();
+}
+
+void CollectorDevice::channelEvent(unsigned char *ant_message)
+{
+    // byte 3 channel number
+    // byte 4 message id (1 for RF events)
+    // byte 5 message code
+
+    if (! (ant_message[4] == 1))
+    {
+        // response to one of our configuration messages
+        if (ant_message[5] != RESPONSE_NO_ERROR)
+            qDebug() << "CollectorDevice::channelEvent" << "config message" << ant_message[4] << "failed with" << ant_message[5];
+        return;
+    }
+
+    switch (ant_message[5])
+    {
+    case EVENT_CHANNEL_CLOSED:
+        qDebug() << "CollectorDevice::channelEvent" << "EVENT_CHANNEL_CLOSED";
+        break;
+    default:
+        break;
+    }
+}
+
+void CollectorDevice::handleAckData(unsigned char *ant_message)
+{
+    // acknowledged data from the scan is treated just like a broadcast
+    handleBroadcastData(ant_message);
+}
+
+void CollectorDevice::handleBroadcastData(unsigned char *ant_message)
+{
+    // byte 0 sync
+    // byte 1 len
+    // byte 2 type
+    // byte 3 channel number
+    // byte 4-11 payload
+    // byte 12- extended data, see ANTMessage::parseExtendedData()
+
+    ANTExtendedData ext;
+    if (!ANTMessage::parseExtendedData(ant_message, ext) || !(ext.flags & ANT_EXT_FLAG_CHANNEL_ID))
+    {
+        // without the channel id there is no telling the bikes apart
+        return;
+    }
+
+    const unsigned char *payload = ant_message + 4;
+    ext.deviceType &= 0x7F; // top bit is the pairing bit
+
+    switch (ext.deviceType)
+    {
+    case DEVICE_TYPE_POWER:
+        if (payload[0] == 0x10) // standard power-only page
+        {
+            addSample(ext, payload[6] | (payload[7] << 8), payload[3]);
+        }
+        break;
+    case DEVICE_TYPE_FEC:
+        if (payload[0] == 0x19) // trainer/stationary bike data
+        {
+            addSample(ext, payload[5] | ((payload[6] & 0x0F) << 8), payload[2]);
+        }
+        else if (payload[0] == 0x15) // stationary bike data
+        {
+            addSample(ext, payload[5] | (payload[6] << 8), payload[4]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+qint64 CollectorDevice::unwrapRxTimestamp(unsigned short rxTimestamp, qint64 now)
+{
+    // The stick clock wraps every 2 s. Use the host clock to tell how many
+    // wraps were missed when it's been quiet for a while.
+    if (m_rxTicks < 0)
+    {
+        m_rxTicks = rxTimestamp;
+    }
+    else
+    {
+        const qint64 wrapped = (unsigned short)(rxTimestamp - m_lastRxTimestamp);
+        const qint64 hostTicks = (now - m_lastRxHostTime) * 32768 / 1000;
+        const qint64 wraps = qMax(qint64(0), (hostTicks - wrapped + 32768) / 65536);
+        m_rxTicks += wrapped + wraps * 65536;
+    }
+
+    m_lastRxTimestamp = rxTimestamp;
+    m_lastRxHostTime = now;
+
+    return m_rxTicks * 1000000 / 32768;
+}
+
+void CollectorDevice::addSample(const ANTExtendedData &ext, quint16 power, quint8 cadence)
+{
+    const unsigned short deviceNumber = ext.deviceNumber;
+    const unsigned char deviceType = ext.deviceType;
+    const DeviceKey key(deviceNumber, deviceType);
+
+    Sample sample;
+    sample.timestamp = m_timer.elapsed();
+    sample.rxTime = (ext.flags & ANT_EXT_FLAG_TIMESTAMP) ? unwrapRxTimestamp(ext.rxTimestamp, sample.timestamp) : 0;
+    sample.rssi = (ext.flags & ANT_EXT_FLAG_RSSI) ? ext.rssi : 0;
+    sample.power = power;
+    sample.cadence = cadence;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (!m_records.contains(key))
+        {
+            Record record;
+            record.history.resize(COLLECTOR_HISTORY_SIZE);
+            record.historyIndex = 0;
+            record.historyCount = 0;
+            m_records.insert(key, record);
+
+            qDebug() << "CollectorDevice: new device" << deviceNumber << "type" << deviceType;
+        }
+
+        Record &record = m_records[key];
+        record.latest = sample;
+        record.history[record.historyIndex] = sample;
+        record.historyIndex = (record.historyIndex + 1) % COLLECTOR_HISTORY_SIZE;
+        if (record.historyCount < COLLECTOR_HISTORY_SIZE)
+            record.historyCount++;
+    }
+
+    emit sampleReceived(deviceNumber, deviceType, power, cadence);
+}
+
+QList<CollectorDevice::DeviceKey> CollectorDevice::devices() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_records.keys();
+}
+
+CollectorDevice::Sample CollectorDevice::latest(const DeviceKey &device) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    Sample sample = {0, 0, 0, 0, 0};
+    if (m_records.contains(device))
+        sample = m_records[device].latest;
+
+    return sample;
+}
+
+QVector<CollectorDevice::Sample> CollectorDevice::history(const DeviceKey &device) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QVector<Sample> samples;
+    if (!m_records.contains(device))
+        return samples;
+
+    const Record &record = m_records[device];
+    int index = (record.historyIndex - record.historyCount + COLLECTOR_HISTORY_SIZE) % COLLECTOR_HISTORY_SIZE;
+    for (int i = 0; i < record.historyCount; ++i)
+    {
+        samples.append(record.history[index]);
+        index = (index + 1) % COLLECTOR_HISTORY_SIZE;
+    }
+
+    return samples;
+}
+
+void CollectorDevice::setCurrentPower(quint16 power)
+{
+    // nothing to transmit in collector mode
+    Q_UNUSED(power);
+}
+
+void CollectorDevice::setCurrentCadence(quint8 cadence)
+{
+    Q_UNUSED(cadence);
+}
+
+void CollectorDevice::configureChannel()
+{
+    // Slave channel with a wildcard channel id so every master in range matches
+    ANTMessage assignCh = ANTMessage::assignChannel(m_channel, 0x00, 0);
+    m_tx->send(assignCh, ANTTransmitter::Command);
+
+    ANTMessage id = ANTMessage::setChannelID(m_channel, 0, 0, 0);
+    m_tx->send(id, ANTTransmitter::Command);
+
+    ANTMessage chanFreq = ANTMessage::setChannelFreq(m_channel, ANT_SPORT_FREQUENCY);
+    m_tx->send(chanFreq, ANTTransmitter::Command);
+
+    ANTMessage openScan = ANTMessage::openRxScanMode();
+    m_tx->send(openScan, ANTTransmitter::Command);
+}
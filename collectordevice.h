@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef COLLECTORDEVICE_H
+#define COLLECTORDEVICE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QVector>
+#include "antmessage.h"
+#include "antdevice.h"
+
+class ANTTransmitter;
+
+// one minute of history at the 4Hz ANT+ page rate
+#define COLLECTOR_HISTORY_SIZE 240
+
+/*
+ * Listens to every ANT+ power and FE-C broadcast in range using continuous
+ * scan mode on channel 0. Scan mode takes over the radio so this can't run
+ * alongside our own transmitting channels on the same stick.
+ */
+class CollectorDevice : public QObject, public ANTDevice
+{
+    Q_OBJECT
+public:
+    struct Sample {
+        qint64 timestamp; // ms since the collector was started
+        qint64 rxTime; // us on the stick's receive clock, 0 if the stick doesn't report it
+        qint8 rssi; // dBm, 0 if not reported
+        quint16 power;
+        quint8 cadence;
+    };
+
+    // A bridge sends power and FE-C under the same device number, so it
+    // takes both to tell the broadcasts apart
+    typedef QPair<unsigned short, unsigned char> DeviceKey; // device number, device type
+
+    explicit CollectorDevice(ANTTransmitter * tx, const unsigned char channel, QObject *parent = 0);
+
+    int channel() const {return m_channel;}
+    void configureChannel();
+
+    QList<DeviceKey> devices() const;
+    Sample latest(const DeviceKey &device) const;
+    QVector<Sample> history(const DeviceKey &device) const; // oldest first
+
+signals:
+    void sampleReceived(unsigned short deviceNumber, unsigned char deviceType, quint16 power, quint8 cadence);
+
+public slots:
+    void channelEvent(unsigned char *ant_message);
+    void handleAckData(unsigned char *ant_message);
+    void handleBroadcastData(unsigned char *ant_message);
+    void setCurrentPower(quint16 power);
+    void setCurrentCadence(quint8 cadence);
+
+private:
+    struct Record {
+        Sample latest;
+        QVector<Sample> history;
+        int historyIndex;
+        int historyCount;
+    };
+
+    void addSample(const ANTExtendedData &ext, quint16 power, quint8 cadence);
+    qint64 unwrapRxTimestamp(unsigned short rxTimestamp, qint64 now);
+
+    ANTTransmitter *m_tx;
+    unsigned char m_channel;
+    QElapsedTimer m_timer;
+    qint64 m_rxTicks; // stick clock in 1/32768 s, unwrapped
+    unsigned short m_lastRxTimestamp;
+    qint64 m_lastRxHostTime;
+    mutable QMutex m_mutex;
+    QHash<DeviceKey, Record> m_records;
+};
+
+#endif // COLLECTORDEVICE_H
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "controllatency.h"
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QDebug>
+
+struct Command {
+    const void *device;
+    quint8 sequence;
+    quint32 power;
+    qint64 received; // ns on latencyClock()
+    qint64 emitted; // -1 until emitted
+    bool failed; // kept for status() until the device sends another
+};
+
+static QMutex s_mutex;
+static QVector<Command> s_pending;
+static bool s_controllable = true; // until the bike says otherwise
+
+static QElapsedTimer &latencyClock()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock;
+}
+
+void ControlLatency::received(const void *device, quint8 sequence, quint32 power)
+{
+    QMutexLocker locker(&s_mutex);
+
+    // status() only ever asks about a device's last command
+    for (int i = s_pending.size() - 1; i >= 0; --i)
+    {
+        if (s_pending[i].device == device && s_pending[i].failed)
+            s_pending.remove(i);
+    }
+
+    Command c;
+    c.device = device;
+    c.sequence = sequence;
+    c.power = power;
+    c.received = latencyClock().nsecsElapsed();
+    c.emitted = -1;
+    c.failed = false;
+
+    if (s_pending.size() >= CONTROL_LATENCY_PENDING)
+    {
+        qDebug() << "ControlLatency: command" << s_pending.first().sequence << "never reached the bike";
+        s_pending.removeFirst();
+    }
+    s_pending.append(c);
+}
+
+void ControlLatency::emitted(const void *device, quint8 sequence)
+{
+    QMutexLocker locker(&s_mutex);
+
+    for (int i = 0; i < s_pending.size(); ++i)
+    {
+        if (s_pending[i].device == device && s_pending[i].sequence == sequence)
+            s_pending[i].emitted = latencyClock().nsecsElapsed();
+    }
+}
+
+void ControlLatency::written(quint32 load)
+{
+    QMutexLocker locker(&s_mutex);
+
+    const qint64 now = latencyClock().nsecsElapsed();
+
+    // the last command of each device that asked for this load
+    QVector<int> last;
+    for (int i = 0; i < s_pending.size(); ++i)
+    {
+        if (s_pending[i].failed || s_pending[i].power != load)
+            continue;
+
+        bool replaced = false;
+        for (int j = 0; j < last.size(); ++j)
+        {
+            if (s_pending[last[j]].device == s_pending[i].device)
+            {
+                last[j] = i;
+                replaced = true;
+            }
+        }
+        if (!replaced)
+            last.append(i);
+    }
+
+    QVector<Command> remaining;
+    for (int i = 0; i < s_pending.size(); ++i)
+    {
+        const Command &c = s_pending[i];
+
+        int completes = -1;
+        foreach (int index, last)
+        {
+            if (s_pending[index].device == c.device)
+                completes = index;
+        }
+
+        // another device's command, or a later one of this device
+        if (completes < i)
+        {
+            remaining.append(c);
+            continue;
+        }
+
+        if (c.failed)
+            continue;
+
+        const qint64 emitted = c.emitted < 0 ? c.received : c.emitted;
+
+        qDebug() << "ControlLatency: command" << c.sequence << "power" << c.power
+                 << (i == completes ? "" : "superseded")
+                 << "receive to emit us" << (emitted - c.received) / 1000
+                 << "emit to write ms" << (now - emitted) / 1000000
+                 << "total ms" << (now - c.received) / 1000000;
+    }
+
+    s_pending = remaining;
+}
+
+void ControlLatency::setBikeControllable(bool controllable)
+{
+    QMutexLocker locker(&s_mutex);
+
+    if (!controllable && !s_pending.isEmpty())
+        qDebug() << "ControlLatency: the bike takes no load," << s_pending.size() << "commands not supported";
+
+    s_controllable = controllable;
+    if (!controllable)
+        s_pending.clear();
+}
+
+ControlLatency::Status ControlLatency::status(const void *device, quint8 sequence)
+{
+    QMutexLocker locker(&s_mutex);
+
+    if (!s_controllable)
+        return NotSupported;
+
+    const qint64 now = latencyClock().nsecsElapsed();
+
+    for (int i = 0; i < s_pending.size(); ++i)
+    {
+        Command &c = s_pending[i];
+        if (c.device != device || c.sequence != sequence)
+            continue;
+
+        if (!c.failed && now - c.received > qint64(CONTROL_LATENCY_TIMEOUT_MS) * 1000000)
+        {
+            qDebug() << "ControlLatency: command" << c.sequence << "power" << c.power << "not written after"
+                     << CONTROL_LATENCY_TIMEOUT_MS << "ms, failed";
+            c.failed = true;
+        }
+        return c.failed ? Failed : Pending;
+    }
+    return Done;
+}
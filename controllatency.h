@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef CONTROLLATENCY_H
+#define CONTROLLATENCY_H
+
+#include <QtGlobal>
+
+#define CONTROL_LATENCY_PENDING 16 // commands tracked until the bike gets them
+#define CONTROL_LATENCY_TIMEOUT_MS 3000 // a command not written by then has failed
+
+/*
+ * Follows each FE-C control command from the stick to the bike. The stages
+ * are stamped from whichever thread reaches them: received() when the
+ * command page comes in, emitted() when the new load leaves FECDevice and
+ * written() when MonarkConnection has given the bike a load.
+ *
+ * Sequence numbers are per device, every FE-C channel counts its own, so
+ * commands are kept under the device they came in on. A write completes
+ * the device's latest command asking for that load and everything before
+ * it from the same device, the older ones were superseded before the bike
+ * saw them. Each completed command is logged with its per stage latency.
+ * One that isn't written within CONTROL_LATENCY_TIMEOUT_MS has failed.
+ *
+ * A bike without a servo never takes a load, MonarkConnection says so
+ * through setBikeControllable() and every command is not supported.
+ */
+class ControlLatency
+{
+public:
+    enum Status {Done, Pending, Failed, NotSupported};
+
+    static void received(const void *device, quint8 sequence, quint32 power);
+    static void emitted(const void *device, quint8 sequence);
+    static void written(quint32 load);
+    static void setBikeControllable(bool controllable);
+
+    static Status status(const void *device, quint8 sequence);
+};
+
+#endif // CONTROLLATENCY_H
@@ -17,40 +17,97 @@
  */
 
 #include "fecdevice.h"
-#include "LibUsb.h"
+#include "controllatency.h"
 #include <QDebug>
 
 #define FEC_STATE_MASK 0xF0
 #define FEC_CAPS_MASK 0x0F
 
-FECDevice::FECDevice(LibUsb *usb, const unsigned char channel, unsigned short deviceId, QObject *parent) : QObject(parent),
-    m_usb(usb),
+// page 16 capabilities
+#define FEC_CAPS_DISTANCE      0x04
+#define FEC_CAPS_VIRTUAL_SPEED 0x08
+
+// page 71 command status
+#define FEC_COMMAND_PASS          0
+#define FEC_COMMAND_FAIL          1
+#define FEC_COMMAND_NOT_SUPPORTED 2
+#define FEC_COMMAND_PENDING       4
+
+// page 54, FE capabilities: no max resistance, target power and simulation modes
+typedef ANTStaticPage<0x36, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x06> FECCapabilitiesPage;
+
+// pages 50, 51 and 55 before the display sends its own, every field invalid
+typedef ANTStaticPage<0x32, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF> FECWindResistancePage;
+typedef ANTStaticPage<0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF> FECTrackResistancePage;
+typedef ANTStaticPage<0x37, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF> FECUserConfigurationPage;
+
+FECDevice::FECDevice(ANTTransmitter *tx, const unsigned char channel, unsigned short deviceId, QObject *parent) : QObject(parent),
+    ANTProfile<FECDevice>(tx, channel, deviceId),
     m_currLapMarkerHigh(false),
     m_state(State::Ready),
-    m_channel(channel),
     m_currPower(100),
     m_targetPower(0),
     m_cadence(0),
     m_heartRate(0),
-    m_lastPage(-1),
-    m_nextPage(16),
-    m_deviceId(deviceId)
+    m_eventCount(0),
+    m_accuPower(0),
+    m_lastCommandId(0xFF),
+    m_lastCommandSequence(0xFF),
+    m_lastCommandStatus(0xFF),
+    m_controllable(true)
 {
     m_timer.start();
 
-}
-
-ANTMessage FECDevice::fecPage16(bool toggleLap)
-{
-    const unsigned char page = 0x10;    // page 16
     const unsigned char eqType = 0x19;  // trainer
     //const unsigned char eqType = 0x15;  // stationary bike
-    const unsigned char distance = 0xFF; // not used due to our capabilities field, value doesn't matter
-    const unsigned char speedMSB = 0x0; // set speed to zero, it's a required field for trainers
+    const unsigned char distance = 0x0; // patched from the speed model on every page
+    const unsigned char speedMSB = 0x0;
     const unsigned char speedLSB = 0x0;
     const unsigned char heartRate = 0xFF; // set to invalid, not required value
 
-    const unsigned char capabilities = 0x0; // Bit 0-3 No HR source, No distance or speed
+    m_page16 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x10, eqType, 0, distance, speedLSB, speedMSB, heartRate, 0);
+    m_page17 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x11, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 0, 0);
+    m_page21 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x15, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0);
+    m_page25 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x19, 0, 0, 0, 0, 0, 0, 0);
+    m_page49 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x31, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0);
+
+    m_page54 = ANTMessage::staticPage<FECCapabilitiesPage>(m_channel);
+    m_page71 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x47, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF);
+
+    m_page50 = ANTMessage::staticPage<FECWindResistancePage>(m_channel);
+    m_page51 = ANTMessage::staticPage<FECTrackResistancePage>(m_channel);
+    m_page55 = ANTMessage::staticPage<FECUserConfigurationPage>(m_channel);
+
+    // the engine's load goes out the same way as a target power from the display
+    connect(&m_simulation, SIGNAL(targetPower(quint32)), this, SLOT(setSimulatedTargetPower(quint32)), Qt::DirectConnection);
+}
+
+FECDevice::~FECDevice()
+{
+    m_simulation.stop();
+    m_simulation.wait();
+}
+
+const ANTMessage &FECDevice::encodePage(int page)
+{
+    switch (page)
+    {
+    case 25:
+        return fecPage25(false);
+        // return fecPage21(false);
+    case 17:
+        return fecPage17(false);
+    case 16:
+    default:
+        return fecPage16(false);
+    }
+}
+
+const ANTMessage &FECDevice::fecPage16(bool toggleLap)
+{
+    // page 16, elapsed time, state and the simulated speed and distance
+    const unsigned char capabilities = FEC_CAPS_DISTANCE | FEC_CAPS_VIRTUAL_SPEED; // No HR source
+    const unsigned short speed = m_simulation.speed();
 
     if (toggleLap)
     {
@@ -67,12 +124,18 @@ ANTMessage FECDevice::fecPage16(bool toggleLap)
 
     const unsigned char caps_and_state = ( ((((unsigned char)m_state) << 4) | lap) & FEC_STATE_MASK) | (capabilities & FEC_CAPS_MASK);
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, eqType, time, distance, speedLSB, speedMSB, heartRate, caps_and_state);
+    m_page16.setPageByte(2, time);
+    m_page16.setPageByte(3, m_simulation.distance() & 0xFF); // m, rolls over at 256
+    m_page16.setPageByte(4, speed & 0x00FF);
+    m_page16.setPageByte(5, speed >> 8);
+    m_page16.setPageByte(7, caps_and_state);
+
+    return m_page16;
 }
 
-ANTMessage FECDevice::fecPage17(bool toggleLap)
+const ANTMessage &FECDevice::fecPage17(bool toggleLap)
 {
-    const unsigned char page = 0x11; // page 17
+    // page 17
 
     if (toggleLap)
     {
@@ -86,15 +149,53 @@ ANTMessage FECDevice::fecPage17(bool toggleLap)
 
     const unsigned char caps_and_state = ((((unsigned char)m_state) << 4) | lap);
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, resistance, caps_and_state);
+    m_page17.setPageByte(6, resistance);
+    m_page17.setPageByte(7, caps_and_state);
+
+    return m_page17;
 }
 
-ANTMessage FECDevice::fecPage54()
+const ANTMessage &FECDevice::fecPage54()
 {
-    const unsigned char page = 0x36; // page 54
-    const unsigned char caps = 0b00000010; // support target power mode only
+    return m_page54;
+}
+
+const ANTMessage &FECDevice::fecPage49()
+{
+    // page 49, the target power currently in effect in 0.25W
+    const unsigned short power = m_targetPower * 4;
+
+    m_page49.setPageByte(6, power & 0x00FF);
+    m_page49.setPageByte(7, power >> 8);
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, caps);
+    return m_page49;
+}
+
+const ANTMessage *FECDevice::requestedPage(int page)
+{
+    switch (page)
+    {
+    case 16:
+        return &fecPage16(false);
+    case 17:
+        return &fecPage17(false);
+    case 25:
+        return &fecPage25(false);
+    case 49:
+        return &fecPage49();
+    case 50:
+        return &m_page50;
+    case 51:
+        return &m_page51;
+    case 54:
+        return &fecPage54();
+    case 55:
+        return &m_page55;
+    case 71:
+        return &fecPage71();
+    default:
+        return ANTProfile<FECDevice>::requestedPage(page);
+    }
 }
 
 double FECDevice::powerFromFecPage49(const unsigned char *message)
@@ -111,49 +212,56 @@ double FECDevice::powerFromFecPage49(const unsigned char *message)
 
 }
 
-ANTMessage FECDevice::fecPage80()
-{
-    const unsigned char page = 0x50; // page 80
-
-    const unsigned char manuMSB = 0x00;
-    const unsigned char manuLSB = 0xFF; // 0x00FF is reserved for development
-
-    const unsigned char hwRev = 0x01;
-
-    const unsigned char modMSB = 0x00;
-    const unsigned char modLSB = 0x01;
-
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, 0xFF, hwRev, manuLSB, manuMSB, modLSB, modMSB);
-}
-
-ANTMessage FECDevice::fecPage81()
+const ANTMessage &FECDevice::fecPage71()
 {
-    const unsigned char page = 0x51; // page 80
+    // page 71, command status of the last control page received. Pending
+    // until the bike has been given the load, then pass, or fail if it
+    // never was.
+    unsigned char status = m_lastCommandStatus;
+    switch (ControlLatency::status(this, m_lastCommandSequence))
+    {
+    case ControlLatency::Pending:
+        status = FEC_COMMAND_PENDING;
+        break;
+    case ControlLatency::Failed:
+        status = FEC_COMMAND_FAIL;
+        break;
+    case ControlLatency::NotSupported:
+        if (m_lastCommandId != 0xFF)
+            status = FEC_COMMAND_NOT_SUPPORTED;
+        break;
+    case ControlLatency::Done:
+        break;
+    }
+    const unsigned short power = m_targetPower * 4;
 
-    const unsigned char swRevSupp = 0xFF; // 0xFF for not used
-    const unsigned char swRevMain = 0x01;
+    m_page71.setPageByte(1, m_lastCommandId);
+    m_page71.setPageByte(2, m_lastCommandSequence);
+    m_page71.setPageByte(3, status);
 
-    const unsigned char serial = 0xFF; // 0xFFFFFFFF for devices without serial number
+    for (int i = 4; i < 8; ++i)
+        m_page71.setPageByte(i, 0xFF);
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, swRevSupp, swRevMain, serial, serial, serial, serial);
-}
-
-ANTMessage FECDevice::fecPage71(const unsigned char lastReceivedCommandId,
-                                const unsigned char sequenceId,
-                                const unsigned char commandStatus,
-                                const unsigned char d0,
-                                const unsigned char d1,
-                                const unsigned char d2,
-                                const unsigned char d3)
-{
-    const unsigned char page = 0x47; // page 71
+    switch (m_lastCommandId)
+    {
+    case 0x31:
+        m_page71.setPageByte(6, power & 0x00FF);
+        m_page71.setPageByte(7, power >> 8);
+        break;
+    case 0x32:
+    case 0x33:
+        // the settings as given, same place as in the command page
+        for (int i = 5; i < 8; ++i)
+            m_page71.setPageByte(i, (m_lastCommandId == 0x32 ? m_page50 : m_page51).data[ANT_OFFSET_DATA + 1 + i]);
+        break;
+    }
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, lastReceivedCommandId, sequenceId, commandStatus, d0, d1, d2, d3);
+    return m_page71;
 }
 
-ANTMessage FECDevice::fecPage21(bool toggleLap)
+const ANTMessage &FECDevice::fecPage21(bool toggleLap)
 {
-    const unsigned char page = 0x15; // page 21 (stationary bike specific main page)
+    // page 21 (stationary bike specific main page)
 
     if (toggleLap)
     {
@@ -166,24 +274,19 @@ ANTMessage FECDevice::fecPage21(bool toggleLap)
     unsigned char lap = m_currLapMarkerHigh ? (1<<7) : 0;
     const unsigned char caps_and_state = ((((unsigned char)m_state) << 4) | lap);
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, 0xFF, 0xFF, cadence, power & 0x00FF, (power & 0xFF00) >> 8, caps_and_state);
+    m_page21.setPageByte(4, cadence);
+    m_page21.setPageByte(5, power & 0x00FF);
+    m_page21.setPageByte(6, (power & 0xFF00) >> 8);
+    m_page21.setPageByte(7, caps_and_state);
 
+    return m_page21;
 }
 
-ANTMessage FECDevice::fecPage25(bool toggleLap)
+const ANTMessage &FECDevice::fecPage25(bool toggleLap)
 {
-    static unsigned char eventCount = 0;
-    const unsigned char page = 0x19; // page 25 (trainer specific main page)
-
-    static unsigned short accuPower = 0;
-
-    accuPower += m_currPower;
+    // page 25 (trainer specific main page)
 
-    const unsigned char accuPowerLSB = accuPower & 0x00FF;
-    const unsigned char accuPowerMSB = accuPower >> 8;
-
-    const unsigned char instPowerLSB = m_currPower & 0x00FF;
-    const unsigned char instPowerMSB = m_currPower >> 8;
+    m_accuPower += m_currPower;
 
     if (toggleLap)
     {
@@ -194,8 +297,15 @@ ANTMessage FECDevice::fecPage25(bool toggleLap)
 
     const unsigned char flags_and_status = 0;
 
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, eventCount++, cadence, accuPowerLSB, accuPowerMSB, instPowerLSB, instPowerMSB, flags_and_status);
+    m_page25.setPageByte(1, m_eventCount++);
+    m_page25.setPageByte(2, cadence);
+    m_page25.setPageByte(3, m_accuPower & 0x00FF);
+    m_page25.setPageByte(4, m_accuPower >> 8);
+    m_page25.setPageByte(5, m_currPower & 0x00FF);
+    m_page25.setPageByte(6, m_currPower >> 8);
+    m_page25.setPageByte(7, flags_and_status);
 
+    return m_page25;
 }
 
 void FECDevice::setState(State newState)
@@ -206,11 +316,13 @@ void FECDevice::setState(State newState)
 void FECDevice::setCadence(int cadence)
 {
     m_cadence = cadence;
+    m_simulation.setCadence(cadence);
 }
 
 void FECDevice::setCurrentPower(int power)
 {
     m_currPower = power;
+    m_simulation.integratePower(power);
 }
 
 void FECDevice::setHeartrate(int heartrate)
@@ -218,143 +330,146 @@ void FECDevice::setHeartrate(int heartrate)
     m_heartRate = heartrate;
 }
 
+void FECDevice::setSimulatedTargetPower(quint32 targetPower)
+{
+    // parked by a page 49 in the meantime, that target stands
+    if (!m_simulation.active())
+        return;
+
+    // pages 17 and 49 report the load the engine gave the bike
+    m_targetPower = targetPower;
+    emit newTargetPower(targetPower);
+}
+
 void FECDevice::setTargetPower(quint32 targetPower)
 {
     if (m_targetPower != targetPower)
     {
         m_targetPower = targetPower;
-        emit newTargetPower(m_targetPower);
-        qDebug() << "New target power: " << m_targetPower;
+        emit newTargetPower(targetPower);
+        qDebug() << "New target power: " << targetPower;
     }
 }
 
-void FECDevice::channelEvent(unsigned char *ant_message)
+void FECDevice::handleTargetPowerCommand(const unsigned char *message)
 {
-    // byte 0 sync
-    // byte 1 len
-    // byte 2 type (channel event 0x40 if we get it here)
-    // byte 3 channel number
-    // byte 4 message id (1 for RF events)
-    // byte 5 message code
-
-    if (! (ant_message[2] == 0x40))
+    const quint32 targetPower = powerFromFecPage49(message);
+
+    // 0-254, 255 means no control page received yet
+    m_lastCommandId = message[0];
+    m_lastCommandSequence = m_lastCommandSequence == 0xFF ? 0 : (m_lastCommandSequence + 1) % 255;
+    m_lastCommandStatus = FEC_COMMAND_PASS;
+
+    // coming out of simulation the target is sent even if the engine's last
+    // load matched it, one more engine step may still be on its way
+    const bool modeChange = m_simulation.active();
+    if (modeChange)
     {
-        qDebug() << "FECDevice::channelEvent() called with wrong message type";
-        return;
+        qDebug() << "FECDevice: target power mode";
+        m_simulation.setActive(false);
     }
 
-    // Make sure we're the right channel
-    if (! (ant_message[3] == m_channel))
-    {
-        qDebug() << "FECDevice::channelEvent() called with wrong channel";
+    // an unchanged target is in effect already, nothing goes to the bike
+    if (m_targetPower == targetPower && !modeChange)
         return;
-    }
 
-    // Make sure it's an RF event
-    if (! (ant_message[4] == 1))
+    ControlLatency::received(this, m_lastCommandSequence, targetPower);
+    if (modeChange)
     {
-        qDebug() << "FECDevice::channelEvent() called, but not RF event";
-        return;
+        m_targetPower = targetPower;
+        emit newTargetPower(targetPower);
+        qDebug() << "New target power: " << targetPower;
+    }
+    else
+    {
+        setTargetPower(targetPower);
     }
+    ControlLatency::emitted(this, m_lastCommandSequence);
+}
+
+void FECDevice::handleSimulationCommand(const unsigned char *message)
+{
+    ANTMessage *page = 0;
 
-    switch (ant_message[5])
+    switch (message[0])
     {
-    case RESPONSE_NO_ERROR:
-        qDebug() << "FECDevice::channelEvent" << "RESPONSE_NO_ERROR";
-        break;
-    case EVENT_RX_SEARCH_TIMEOUT:
-        qDebug() << "FECDevice::channelEvent" << "EVENT_RX_SEARCH_TIMEOUT";
-        break;
-    case EVENT_RX_FAIL:
-        qDebug() << "FECDevice::channelEvent" << "EVENT_RX_FAIL";
-        break;
-    case EVENT_TX:
-        //qDebug() << "FECDevice::channelEvent" << "EVENT_TX";
-        sendNextPage();
-        break;
-    case EVENT_TRANSFER_RX_FAILED:
-        qDebug() << "FECDevice::channelEvent" << "EVENT_TRANSFER_RX_FAILED";
+    case 0x32:
+    {
+        // wind resistance coefficient 0.01kg/m, wind speed km/h offset by 127, drafting factor 0.01
+        const double coefficient = message[5] == 0xFF ? FEC_SIM_DEFAULT_WIND_COEFF : message[5] * 0.01;
+        const double windSpeed = message[6] == 0xFF ? 0 : message[6] - 127;
+        const double drafting = message[7] == 0xFF ? 1.0 : qMin(message[7], (unsigned char)100) * 0.01;
+        m_simulation.setWind(coefficient, windSpeed, drafting);
+        page = &m_page50;
         break;
-    case EVENT_TRANSFER_TX_COMPLETED:
-        qDebug() << "FECDevice::channelEvent" << "EVENT_TRANSFER_TX_COMPLETED";
+    }
+    case 0x33:
+    {
+        // grade 0.01% offset by -200%, rolling resistance 5*10^-5
+        const unsigned short grade = message[5] | (message[6] << 8);
+        const double crr = message[7] == 0xFF ? FEC_SIM_DEFAULT_CRR : message[7] * 0.00005;
+        m_simulation.setTrack(grade == 0xFFFF ? 0 : grade * 0.01 - 200.0, crr);
+        page = &m_page51;
         break;
-    case EVENT_CHANNEL_COLLISION:
-        qDebug() << "FECDevice::channelEvent" << "EVENT_CHANNEL_COLLISION";
+    }
+    case 0x37:
+    {
+        // user weight 0.01kg, bike weight 12 bits of 0.05kg, wheel 0.01m plus mm offset, gear ratio 0.03
+        const unsigned short user = message[1] | (message[2] << 8);
+        const unsigned short bike = (message[4] >> 4) | (message[5] << 4);
+        const unsigned char offset = message[4] & 0x0F;
+        double wheel = message[6] == 0xFF ? FEC_SIM_DEFAULT_WHEEL : message[6] * 0.01;
+        if (message[6] != 0xFF && offset != 0x0F)
+            wheel += offset * 0.001;
+
+        m_simulation.setUserConfiguration(user == 0xFFFF ? FEC_SIM_DEFAULT_USER_WEIGHT : user * 0.01,
+                                          bike == 0xFFF ? FEC_SIM_DEFAULT_BIKE_WEIGHT : bike * 0.05,
+                                          wheel,
+                                          message[7] == 0 ? FEC_SIM_DEFAULT_GEAR_RATIO : message[7] * 0.03);
+        page = &m_page55;
         break;
+    }
     default:
-        // There's a lot not handled yet here
-        qDebug() << "FECDevice::channelEvent" << " unhandled message";
-        break;
+        return;
     }
-}
 
-void FECDevice::sendNextPage()
-{
-    ANTMessage m;
-    static int patternCounter = 0;
-    static int commonCounter = 0;
-    static int nextCommonPage = 80;
+    // kept as received for displays asking for the current settings
+    for (int i = 0; i < 8; ++i)
+        page->setPageByte(i, message[i]);
 
-    if (patternCounter < 64)
-    {
+    // user data isn't a control command and doesn't change the mode
+    if (message[0] == 0x37)
+        return;
 
-        // This is somwhat according to recommended pattern from ANT+ FE-C docs (expect for not using 18)
-        switch (patternCounter++%8)
-        {
-        case 0:
-        case 1:
-        case 4:
-        case 5:
-            m = fecPage16(false);
-            break;
-        case 2:
-        case 6:
-            m = fecPage25(false);
-            // m = fecPage21(false);
-            break;
-        case 3:
-        case 7:
-            m = fecPage17(false);
-            break;
-        }
-    } else {
-        if (nextCommonPage == 80)
-        {
-            m = fecPage80();
-        } else {
-            m = fecPage81();
-        }
+    m_lastCommandId = message[0];
+    m_lastCommandSequence = m_lastCommandSequence == 0xFF ? 0 : (m_lastCommandSequence + 1) % 255;
+    m_lastCommandStatus = FEC_COMMAND_PASS;
 
-        if (++commonCounter == 2)
-        {
-            nextCommonPage = (nextCommonPage == 80) ? 81 : 80;
-            commonCounter = 0;
-            patternCounter = 0;
-        }
+    if (!m_simulation.active())
+    {
+        qDebug() << "FECDevice: simulation mode";
+        m_simulation.setActive(true);
+        if (!m_simulation.isRunning())
+            m_simulation.start();
     }
-
-    m_usb->write((char*)m.data, m.length);
 }
 
-void FECDevice::handleAckData(unsigned char *ant_message)
+void FECDevice::setControllable(bool controllable)
 {
+    m_controllable = controllable;
 
-    // byte 0 sync
-    // byte 1 len
-    // byte 2 type (channel event 0x40 if we get it here)
-    // byte 3 channel number
-    // byte 4 message id
-
-    if (! (ant_message[2] == 0x4F))
-    {
-        qDebug() << "FECDevice::handleAckData() called with wrong message type";
-        return;
-    }
+    // no target power or simulation mode to offer
+    m_page54.setPageByte(7, controllable ? 0x06 : 0x00);
+}
 
-    // Make sure we're the right channel
-    if (! (ant_message[3] == m_channel))
+void FECDevice::handleAckPage(unsigned char *ant_message)
+{
+    if (!m_controllable && (ant_message[4] == 0x31 || ant_message[4] == 0x32 || ant_message[4] == 0x33))
     {
-        qDebug() << "FECDevice::handleAckData() called with wrong channel";
+        // answered in page 71, another channel has the bike
+        m_lastCommandId = ant_message[4];
+        m_lastCommandSequence = m_lastCommandSequence == 0xFF ? 0 : (m_lastCommandSequence + 1) % 255;
+        m_lastCommandStatus = FEC_COMMAND_NOT_SUPPORTED;
         return;
     }
 
@@ -362,73 +477,27 @@ void FECDevice::handleAckData(unsigned char *ant_message)
     case 0x31: // power
         {
             unsigned char * ant_sport_mess = ant_message+4;
-            setTargetPower(powerFromFecPage49(ant_sport_mess));
+            handleTargetPowerCommand(ant_sport_mess);
         }
         break;
-    case 0x46: // Request for a special page, we should only get req for page 54
-    {
-        unsigned char * ant_sport_mess = ant_message+4;
-        handlePageRequest(ant_sport_mess);
+    case 0x32: // wind resistance
+    case 0x33: // track resistance
+    case 0x37: // user configuration
+        handleSimulationCommand(ant_message+4);
         break;
-    }
     default:
         qDebug() << __func__ << "Unhandled" << ant_message[4] ;
     }
 }
 
-void FECDevice::handlePageRequest(unsigned char *message)
-{
-    const unsigned char descriptorByte1 = message[3];
-    const unsigned char descriptorByte2 = message[4];
-    const unsigned char numberOfTimes = message[5] & 0x7F;
-    bool replyUsingAck = message[5]>>7 == 1;
-    const unsigned char requestedPage = message[6];
-    const unsigned char commandType = message[7];
-
-    if (replyUsingAck)
-        qDebug() << "FECDevice::handlePageRequest - replyUsingAck requested but not supported";
-
-
-    if (commandType == 1) // Request Data Page
-    {
-        switch(requestedPage)
-        {
-        case 54:
-        {
-            ANTMessage m = fecPage54();
-            m_usb->write((char*)m.data, m.length);
-        }
-            break;
-        default:
-            qDebug() << "FECDevice::handlePageRequest - unhandled request for page " << requestedPage;
-        }
-    }
-}
-
-void FECDevice::configureChannel()
-{
-    ANTMessage assignCh = ANTMessage::assignChannel(m_channel, 0x10, 0);
-    m_usb->write((char *)assignCh.data,assignCh.length);
-
-    ANTMessage id = ANTMessage::setChannelID(m_channel, m_deviceId, 0x11, 0x05);
-    m_usb->write((char *)id.data, id.length);
-
-    ANTMessage chanPeriod = ANTMessage::setChannelPeriod(m_channel,8192);
-    m_usb->write((char *)chanPeriod.data, chanPeriod.length);
-
-    ANTMessage chanFreq = ANTMessage::setChannelFreq(m_channel, 57); // 57 ANT Sport
-    m_usb->write((char *)chanFreq.data, chanFreq.length);
-
-    ANTMessage openChan = ANTMessage::open(m_channel);
-    m_usb->write((char *)openChan.data, openChan.length);
-}
-
 void FECDevice::setCurrentCadence(quint8 cadence)
 {
     m_cadence = cadence;
+    m_simulation.setCadence(cadence);
 }
 
 void FECDevice::setCurrentPower(quint16 power)
 {
     m_currPower = power;
+    m_simulation.integratePower(power);
 }
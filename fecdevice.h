@@ -21,38 +21,53 @@
 
 #include <QObject>
 #include <QElapsedTimer>
+#include <atomic>
 #include "antmessage.h"
-#include "antdevice.h"
+#include "antprofile.h"
+#include "fecsimulation.h"
 
-class LibUsb;
 
-class FECDevice : public QObject, public ANTDevice
+class FECDevice : public QObject, public ANTProfile<FECDevice>
 {
     Q_OBJECT
 public:
-    explicit FECDevice(LibUsb * usb, const unsigned char channel, unsigned short deviceId, QObject *parent = 0);
-
+    // ANT+ fitness equipment, trainer pattern x 64 then two each of 0x50 or 0x51.
+    // This is somwhat according to recommended pattern from ANT+ FE-C docs (expect for not using 18)
+    static const unsigned char DeviceType = 0x11;
+    static const unsigned char TransmissionType = 0x05;
+    static const unsigned char Network = 0;
+    static const unsigned short Period = 8192;
+    static const bool FixedPeriod = true;
+    static const bool FixedFrequency = true;
+    static const int MainPageCount = 64;
+    static const int CommonPageRepeat = 2;
+    static QVector<int> pagePattern() {return QVector<int>() << 16 << 16 << 25 << 17 << 16 << 16 << 25 << 17;}
+    static const char *name() {return "FECDevice";}
+
+    explicit FECDevice(ANTTransmitter * tx, const unsigned char channel, unsigned short deviceId, QObject *parent = 0);
+    ~FECDevice();
+
+    // Only one FE-C channel may drive the bike, the others broadcast the
+    // same data and turn control pages down
+    void setControllable(bool controllable);
+
+    const ANTMessage &encodePage(int page);
+    void handleAckPage(unsigned char *ant_message);
+    const ANTMessage *requestedPage(int page);
 
     // outgoing pages
-    ANTMessage fecPage16(bool toggleLap);
+    const ANTMessage &fecPage16(bool toggleLap);
 
-    ANTMessage fecPage17(bool toggleLap);
+    const ANTMessage &fecPage17(bool toggleLap);
 
-    ANTMessage fecPage21(bool toggleLap);
-    ANTMessage fecPage25(bool toggleLap);
+    const ANTMessage &fecPage21(bool toggleLap);
+    const ANTMessage &fecPage25(bool toggleLap);
 
-    ANTMessage fecPage54(); // send on request
+    const ANTMessage &fecPage49(); // send on request
+    const ANTMessage &fecPage54();
 
     // Common Pages
-    ANTMessage fecPage80();
-    ANTMessage fecPage81();
-    ANTMessage fecPage71(const unsigned char lastReceivedCommandId,
-                         const unsigned char sequenceId,
-                         const unsigned char commandStatus,
-                         const unsigned char d0,
-                         const unsigned char d1,
-                         const unsigned char d2,
-                         const unsigned char d3);
+    const ANTMessage &fecPage71(); // send on request
 
     // incoming pages
     // page 49 required
@@ -65,33 +80,50 @@ public:
     void setTargetPower(quint32 targetPower);
     void setCadence(int cadence);
     void setHeartrate(int heartrate);
+    void handleTargetPowerCommand(const unsigned char *message);
+    void handleSimulationCommand(const unsigned char *message); // pages 50, 51 and 55
 
-    int channel() const {return m_channel;}
-    void configureChannel();
 signals:
     void newTargetPower(quint32 targetPower);
 
 public slots:
-    void channelEvent(unsigned char *ant_message);
-    void handleAckData(unsigned char *ant_message);
-    void handlePageRequest(unsigned char *message);
-    void sendNextPage();
     void setCurrentPower(quint16 power);
     void setCurrentCadence(quint8 cadence);
 
+private slots:
+    void setSimulatedTargetPower(quint32 targetPower); // on the simulation thread
+
 private:
     QElapsedTimer m_timer;
-    LibUsb *m_usb;
     bool m_currLapMarkerHigh;
     State m_state;
-    unsigned char m_channel;
     int m_currPower;
-    quint32 m_targetPower;
+    std::atomic<quint32> m_targetPower; // the load the bike was last given, set or simulated
     int m_cadence;
     int m_heartRate;
-    int m_lastPage;
-    int m_nextPage;
-    unsigned short m_deviceId;
+    unsigned char m_eventCount;
+    unsigned short m_accuPower;
+
+    // pre-encoded pages, only the variable fields are patched before sending
+    ANTMessage m_page16;
+    ANTMessage m_page17;
+    ANTMessage m_page21;
+    ANTMessage m_page25;
+    ANTMessage m_page49;
+    ANTMessage m_page50; // last received, echoed on request
+    ANTMessage m_page51;
+    ANTMessage m_page54;
+    ANTMessage m_page55;
+    ANTMessage m_page71;
+
+    // last control page, for page 71
+    unsigned char m_lastCommandId;
+    unsigned char m_lastCommandSequence;
+    unsigned char m_lastCommandStatus;
+
+    bool m_controllable;
+
+    FECSimulation m_simulation;
 };
 
 #endif // FECDEVICE_H
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fecsimulation.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+#include <cmath>
+
+#define GRAVITY 9.81
+
+FECSimulation::FECSimulation(QObject *parent) : QThread(parent),
+    m_cadence(0),
+    m_speed(0),
+    m_distance(0),
+    m_active(false),
+    m_stop(false),
+    m_virtualSpeed(0),
+    m_virtualDistance(0)
+{
+    m_parameters.mass = FEC_SIM_DEFAULT_USER_WEIGHT + FEC_SIM_DEFAULT_BIKE_WEIGHT;
+    m_parameters.wheelCircumference = M_PI * FEC_SIM_DEFAULT_WHEEL;
+    m_parameters.gearRatio = FEC_SIM_DEFAULT_GEAR_RATIO;
+    m_parameters.windCoefficient = FEC_SIM_DEFAULT_WIND_COEFF;
+    m_parameters.windSpeed = 0;
+    m_parameters.drafting = 1.0;
+    m_parameters.grade = 0;
+    m_parameters.rollingResistance = FEC_SIM_DEFAULT_CRR;
+}
+
+void FECSimulation::setUserConfiguration(double userWeight, double bikeWeight, double wheelDiameter, double gearRatio)
+{
+    QMutexLocker locker(&m_mutex);
+    m_parameters.mass = userWeight + bikeWeight;
+    m_parameters.wheelCircumference = M_PI * wheelDiameter;
+    m_parameters.gearRatio = gearRatio;
+}
+
+void FECSimulation::setWind(double coefficient, double windSpeed, double drafting)
+{
+    QMutexLocker locker(&m_mutex);
+    m_parameters.windCoefficient = coefficient;
+    m_parameters.windSpeed = windSpeed / 3.6;
+    m_parameters.drafting = drafting;
+}
+
+void FECSimulation::setTrack(double grade, double rollingResistance)
+{
+    QMutexLocker locker(&m_mutex);
+    m_parameters.grade = grade;
+    m_parameters.rollingResistance = rollingResistance;
+}
+
+FECSimulation::Parameters FECSimulation::parameters() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_parameters;
+}
+
+// Force in N against the rider at the given speed
+double FECSimulation::resistance(const Parameters &p, double speed)
+{
+    const double angle = atan(p.grade / 100.0);
+    const double air = speed + p.windSpeed;
+
+    return p.mass * GRAVITY * sin(angle)
+         + p.rollingResistance * p.mass * GRAVITY * cos(angle)
+         + 0.5 * p.windCoefficient * air * fabs(air) * p.drafting;
+}
+
+// Speed in m/s the rider's cadence gives through the gear and wheel
+double FECSimulation::cadenceSpeed(const Parameters &p, int cadence)
+{
+    return cadence / 60.0 * p.gearRatio * p.wheelCircumference;
+}
+
+void FECSimulation::integratePower(double power)
+{
+    if (!m_sampleClock.isValid())
+    {
+        m_sampleClock.start();
+        return;
+    }
+
+    const Parameters p = parameters();
+    double remaining = m_sampleClock.restart() / 1000.0;
+
+    // the engine loads the bike for the cadence speed, so that's the speed
+    if (m_active.load())
+    {
+        const double speed = qMin(cadenceSpeed(p, m_cadence.load(std::memory_order_relaxed)), 65.534);
+        m_virtualDistance += (m_virtualSpeed + speed) / 2 * remaining;
+        m_virtualSpeed = speed;
+        remaining = 0;
+    }
+
+    // samples can be a second apart, more than one explicit step can take
+    while (remaining > 0)
+    {
+        const double dt = qMin(remaining, FEC_SIM_SPEED_STEP_MS / 1000.0);
+        const double drive = power / qMax(m_virtualSpeed, 1.0); // no infinite force from standstill
+
+        m_virtualSpeed = qBound(0.0, m_virtualSpeed + dt * (drive - resistance(p, m_virtualSpeed)) / p.mass, 65.534);
+        m_virtualDistance += m_virtualSpeed * dt;
+        remaining -= dt;
+    }
+
+    m_speed.store(quint16(m_virtualSpeed * 1000), std::memory_order_relaxed);
+    m_distance.store(quint32(m_virtualDistance), std::memory_order_relaxed);
+}
+
+void FECSimulation::run()
+{
+    QElapsedTimer clock;
+    double smoothed = -1;
+    quint32 sent = 0;
+
+    clock.start();
+
+    while (!m_stop.load())
+    {
+        msleep(1000 / FEC_SIM_RATE_HZ);
+
+        if (!m_active.load())
+        {
+            QMutexLocker locker(&m_mutex);
+            while (!m_active.load() && !m_stop.load())
+                m_wake.wait(&m_mutex);
+
+            // start over from whatever the ride is like now
+            smoothed = -1;
+            sent = 0;
+            clock.restart();
+            continue;
+        }
+
+        const double dt = clock.restart() / 1000.0;
+
+        const Parameters p = parameters();
+
+        const double speed = cadenceSpeed(p, m_cadence.load(std::memory_order_relaxed));
+        const double power = qBound(0.0, speed * resistance(p, speed), double(FEC_SIM_MAX_POWER));
+
+        if (smoothed < 0)
+            smoothed = power;
+        else
+            smoothed += (power - smoothed) * dt / (FEC_SIM_SMOOTHING_MS / 1000.0 + dt);
+
+        const quint32 target = quint32(smoothed + 0.5);
+        if (target != sent)
+        {
+            sent = target;
+            emit targetPower(target);
+        }
+    }
+}
+
+void FECSimulation::setActive(bool active)
+{
+    QMutexLocker locker(&m_mutex);
+    m_active.store(active);
+    m_wake.wakeAll();
+}
+
+void FECSimulation::stop()
+{
+    QMutexLocker locker(&m_mutex);
+    m_stop.store(true);
+    m_wake.wakeAll();
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FECSIMULATION_H
+#define FECSIMULATION_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <atomic>
+
+#define FEC_SIM_RATE_HZ       10
+#define FEC_SIM_SMOOTHING_MS  1500 // time constant of the low pass in front of the bike
+#define FEC_SIM_MAX_POWER     1000 // W, most a Monark servo will hold
+#define FEC_SIM_SPEED_STEP_MS 100 // longest step when integrating the speed
+
+// FE-C defaults for parameters the display hasn't sent
+#define FEC_SIM_DEFAULT_USER_WEIGHT 75.0 // kg
+#define FEC_SIM_DEFAULT_BIKE_WEIGHT 10.0 // kg
+#define FEC_SIM_DEFAULT_WHEEL       0.7 // m diameter
+#define FEC_SIM_DEFAULT_GEAR_RATIO  2.4 // about 53x22
+#define FEC_SIM_DEFAULT_WIND_COEFF  0.51 // kg/m
+#define FEC_SIM_DEFAULT_CRR         0.004
+
+/*
+ * Physics for FE-C simulation mode. Ten times a second the virtual speed is
+ * worked out from the cadence through the rider's gear and wheel, and the
+ * power needed to hold that speed is
+ *
+ *   P = v * (m g sin(a) + Crr m g cos(a) + 0.5 K (v + w)^2 * drafting)
+ *
+ * for slope angle a, total mass m, wind resistance coefficient K (air
+ * density times CdA, as FE-C defines it) and head wind w. The bike holds whatever power it's
+ * given, so pedalling faster is what makes the ride harder, like shifting
+ * up on the road. The result goes through a low pass so the servo isn't
+ * chasing every cadence sample, and out through targetPower() when it
+ * moves by a watt or more.
+ *
+ * The parameters come from FE-C pages 50, 51 and 55 on the stick thread
+ * and the cadence from the bike, the engine runs in its own thread, which
+ * sleeps on a wait condition while target power mode is in charge.
+ *
+ * There is one virtual speed, reported in page 16 and advanced with each
+ * power sample from the bike, which also adds to the distance. While the
+ * engine is active it's the cadence speed above, the one the bike is
+ * loaded for. In target power mode nothing ties speed to cadence, so the
+ * power sample moves it on by m dv/dt = P/v - F(v) on the defaults or the
+ * last parameters, and picks up from where simulation left it. Reading
+ * either is just an atomic load.
+ */
+class FECSimulation : public QThread
+{
+    Q_OBJECT
+public:
+    explicit FECSimulation(QObject *parent = 0);
+
+    // page 55
+    void setUserConfiguration(double userWeight, double bikeWeight, double wheelDiameter, double gearRatio);
+    // page 50, coefficient in kg/m, wind speed in km/h with head wind positive
+    void setWind(double coefficient, double windSpeed, double drafting);
+    // page 51, grade in %
+    void setTrack(double grade, double rollingResistance);
+
+    void setCadence(int cadence) {m_cadence.store(cadence, std::memory_order_relaxed);}
+
+    // from the thread the bike's samples arrive on
+    void integratePower(double power);
+    quint16 speed() const {return m_speed.load(std::memory_order_relaxed);} // 0.001 m/s
+    quint32 distance() const {return m_distance.load(std::memory_order_relaxed);} // m
+
+    // Only an active engine drives the bike, target power mode takes over otherwise
+    void setActive(bool active);
+    bool active() const {return m_active.load();}
+
+    void stop();
+
+signals:
+    void targetPower(quint32 power);
+
+private:
+    struct Parameters {
+        double mass; // kg, rider and bike
+        double wheelCircumference; // m
+        double gearRatio;
+        double windCoefficient; // kg/m
+        double windSpeed; // m/s
+        double drafting;
+        double grade; // %
+        double rollingResistance;
+    };
+
+    void run();
+    Parameters parameters() const;
+    static double resistance(const Parameters &p, double speed);
+    static double cadenceSpeed(const Parameters &p, int cadence);
+
+    mutable QMutex m_mutex;
+    Parameters m_parameters;
+    QWaitCondition m_wake; // on m_mutex, active or stopping
+
+    std::atomic<int> m_cadence;
+    std::atomic<quint16> m_speed;
+    std::atomic<quint32> m_distance;
+    std::atomic<bool> m_active;
+    std::atomic<bool> m_stop;
+
+    // speed model, only touched by integratePower()
+    QElapsedTimer m_sampleClock;
+    double m_virtualSpeed; // m/s
+    double m_virtualDistance; // m
+};
+
+#endif // FECSIMULATION_H
@@ -22,11 +22,29 @@
 #include "ant.h"
 #include "MonarkConnection.h"
 #include "btcyclingpowerservice.h"
+#include "antmux.h"
+#include "anttrace.h"
+#include "controllatency.h"
+#include "telemetrydevice.h"
 #include <QDebug>
 #include <QNetworkInterface>
 
 int main(int argc, char *argv[])
 {
+    // --ant-mux only shares the stick with other instances, no bike and no window
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--ant-mux") == 0)
+        {
+            QCoreApplication app(argc, argv);
+            ANTTrace::init();
+
+            ANTMux mux(ANTMux::socketPath());
+            mux.start(QThread::HighPriority);
+            return mux.serve() < 0 ? 1 : 0;
+        }
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -64,10 +82,17 @@ int main(int argc, char *argv[])
     QObject::connect(&w, SIGNAL(currentLoadChanged(quint32)), monark, SLOT(setLoad(uint)));
     QObject::connect(monark, SIGNAL(connectionStatus(bool)), &w, SLOT(onConnectionStatusChanged(bool)));
     QObject::connect(ant, SIGNAL(newTargetPower(quint32)), &w, SLOT(setCurrentLoad(quint32)));
+    QObject::connect(monark, &MonarkConnection::loadWritten, &ControlLatency::written); // stamped in the monark thread
+    QObject::connect(monark, &MonarkConnection::controlSupported, &ControlLatency::setBikeControllable);
 
     QObject::connect(monark, &MonarkConnection::power, btpower, &BTCyclingPowerService::setPower);
     QObject::connect(monark, &MonarkConnection::cadence, btpower, &BTCyclingPowerService::setCadence);
 
+#ifdef ENABLE_ANT_TELEMETRY
+    // poll as often as the telemetry channel broadcasts so every frame has a new sample
+    monark->setPollInterval(1000 / TelemetryDevice::sampleRate());
+#endif
+
     monark->start();
     ant->start();
 
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "pagescheduler.h"
+
+PageScheduler::PageScheduler(const QVector<int> &mainPattern, int mainCount, int commonRepeat) :
+    m_mainPattern(mainPattern),
+    m_mainCount(mainCount),
+    m_commonRepeat(commonRepeat)
+{
+    reset();
+}
+
+void PageScheduler::reset()
+{
+    m_patternCounter = 0;
+    m_commonCounter = 0;
+    m_nextCommonPage = 80;
+}
+
+int PageScheduler::nextPage()
+{
+    if (m_commonRepeat == 0)
+    {
+        const int page = m_mainPattern[m_patternCounter];
+        m_patternCounter = (m_patternCounter + 1) % m_mainPattern.size();
+        return page;
+    }
+
+    if (m_patternCounter < m_mainCount)
+    {
+        return m_mainPattern[m_patternCounter++ % m_mainPattern.size()];
+    }
+
+    const int page = m_nextCommonPage;
+
+    if (++m_commonCounter == m_commonRepeat)
+    {
+        m_nextCommonPage = (m_nextCommonPage == 80) ? 81 : 80;
+        m_commonCounter = 0;
+        m_patternCounter = 0;
+    }
+
+    return page;
+}
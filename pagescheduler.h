@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef PAGESCHEDULER_H
+#define PAGESCHEDULER_H
+
+#include <QVector>
+
+/*
+ * Decides which page goes out on the next EVENT_TX. The main pattern is
+ * repeated for mainCount transmissions, then common page 80 or 81 is sent
+ * commonRepeat times, alternating between the two every round. With a
+ * commonRepeat of 0 the main pattern repeats for ever.
+ */
+class PageScheduler
+{
+public:
+    PageScheduler(const QVector<int> &mainPattern, int mainCount, int commonRepeat);
+
+    int nextPage();
+    void reset();
+
+private:
+    QVector<int> m_mainPattern;
+    int m_mainCount;
+    int m_commonRepeat;
+
+    int m_patternCounter;
+    int m_commonCounter;
+    int m_nextCommonPage;
+};
+
+#endif // PAGESCHEDULER_H
@@ -17,196 +17,66 @@
  */
 
 #include "powerdevice.h"
-#include "LibUsb.h"
 #include <QDebug>
 
-PowerDevice::PowerDevice(LibUsb * usb, const unsigned char channel, unsigned short deviceId, QObject *parent) : QObject(parent),
-    m_usb(usb),
-    m_channel(channel),
+// page 01, calibration response: success (0xAC), calibration data 0
+typedef ANTStaticPage<0x01, 0xAC, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00> CalibrationSuccessPage;
+
+PowerDevice::PowerDevice(ANTTransmitter *tx, const unsigned char channel, unsigned short deviceId, QObject *parent) : QObject(parent),
+    ANTProfile<PowerDevice>(tx, channel, deviceId),
     m_power(90),
     m_cadence(0),
-    m_deviceId(deviceId)
+    m_eventCount(0),
+    m_accuPower(0)
 {
+    const unsigned char pedalpower = 0xFF; // not used
+    m_page16 = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0x10, 0, pedalpower, 0, 0, 0, 0, 0);
 
+    m_page01 = ANTMessage::staticPage<CalibrationSuccessPage>(m_channel);
 }
 
-void PowerDevice::channelEvent(unsigned char *ant_message)
+const ANTMessage &PowerDevice::encodePage(int page)
 {
-    // byte 0 sync
-    // byte 1 len
-    // byte 2 type (channel event 0x40 if we get it here)
-    // byte 3 channel number
-    // byte 4 message id (1 for RF events)
-    // byte 5 message code
-
-    if (! (ant_message[2] == 0x40))
-    {
-        qDebug() << "PowerDevice::channelEvent() called with wrong message type";
-        return;
-    }
-
-    // Make sure we're the right channel
-    if (! (ant_message[3] == m_channel))
-    {
-        qDebug() << "PowerDevice::channelEvent() called with wrong channel";
-        return;
-    }
-
-    // Make sure it's an RF event
-    if (! (ant_message[4] == 1))
-    {
-        qDebug() << "PowerDevice::channelEvent() called, but not RF event";
-        return;
-    }
-
-    switch (ant_message[5])
+    // Pages
+    // 0x10, 0x50, 0x51 (common, sent by ANTProfile) 0x01 (calibration, on request)
+    switch (page)
     {
-    case RESPONSE_NO_ERROR:
-        qDebug() << "PowerDevice::channelEvent" << "RESPONSE_NO_ERROR";
-        break;
-    case EVENT_RX_SEARCH_TIMEOUT:
-        qDebug() << "PowerDevice::channelEvent" << "EVENT_RX_SEARCH_TIMEOUT";
-        break;
-    case EVENT_RX_FAIL:
-        qDebug() << "PowerDevice::channelEvent" << "EVENT_RX_FAIL";
-        break;
-    case EVENT_TX:
-        //qDebug() << "PowerDevice::channelEvent" << "EVENT_TX";
-        sendNextPage();
-        break;
-    case EVENT_TRANSFER_RX_FAILED:
-        qDebug() << "PowerDevice::channelEvent" << "EVENT_TRANSFER_RX_FAILED";
-        break;
-    case EVENT_TRANSFER_TX_COMPLETED:
-        qDebug() << "PowerDevice::channelEvent" << "EVENT_TRANSFER_TX_COMPLETED";
-        break;
-    case EVENT_CHANNEL_COLLISION:
-        qDebug() << "PowerDevice::channelEvent" << "EVENT_CHANNEL_COLLISION";
-        break;
+    case 16:
     default:
-        // There's a lot not handled yet here
-        qDebug() << "PowerDevice::channelEvent" << " unhandled message";
-        break;
+        return page16();
     }
 }
 
-void PowerDevice::sendNextPage()
+const ANTMessage &PowerDevice::page16()
 {
+    // page 16, only event count, cadence and power change
+    m_accuPower += m_power;
 
-    // Pages
-    // 0x10, 0x50, 0x51 0x01 (calibration)
-    ANTMessage m;
-    static int patternCounter = 0;
-    static int nextCommonPage = 80;
-
-    if (patternCounter++ < 60)
-    {
-
-        m = page16();
-    } else {
-        if (nextCommonPage == 80)
-        {
-            m = page80();
-        } else {
-            m = page81();
-        }
+    m_page16.setPageByte(1, m_eventCount++);
+    m_page16.setPageByte(3, m_cadence);
+    m_page16.setPageByte(4, m_accuPower & 0x00FF);
+    m_page16.setPageByte(5, m_accuPower >> 8);
+    m_page16.setPageByte(6, m_power & 0x00FF);
+    m_page16.setPageByte(7, m_power >> 8);
 
-        nextCommonPage = (nextCommonPage == 80) ? 81 : 80;
-        patternCounter = 0;
-    }
-
-    m_usb->write((char*)m.data, m.length);
+    return m_page16;
 }
 
-ANTMessage PowerDevice::page16()
+const ANTMessage &PowerDevice::page01()
 {
-    const unsigned char page = 0x10;    // page 16
-    const unsigned char pedalpower = 0xFF; // not used
-    static unsigned char eventCount = 0;
-    static unsigned short accuPower = 0;
-
-    accuPower += m_power;
-
-    const unsigned char accuPowerLSB = accuPower & 0x00FF;
-    const unsigned char accuPowerMSB = accuPower >> 8;
-
-    const unsigned char instPowerLSB = m_power & 0x00FF;
-    const unsigned char instPowerMSB = m_power >> 8;
-
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, eventCount++, pedalpower, m_cadence, accuPowerLSB , accuPowerMSB, instPowerLSB, instPowerMSB);
+    return m_page01;
 }
 
-ANTMessage PowerDevice::page80()
+void PowerDevice::handleAckPage(unsigned char *ant_message)
 {
-    const unsigned char page = 0x50; // page 80
-
-    const unsigned char manuMSB = 0x00;
-    const unsigned char manuLSB = 0xFF; // 0x00FF is reserved for development
-
-    const unsigned char hwRev = 0x01;
-
-    const unsigned char modMSB = 0x00;
-    const unsigned char modLSB = 0x01;
-
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, 0xFF, hwRev, manuLSB, manuMSB, modLSB, modMSB);
-}
-
-ANTMessage PowerDevice::page81()
-{
-    const unsigned char page = 0x51; // page 80
-
-    const unsigned char swRevSupp = 0xFF; // 0xFF for not used
-    const unsigned char swRevMain = 0x01;
-
-    const unsigned char serial = 0xFF; // 0xFFFFFFFF for devices without serial number
-
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, 0xFF, swRevSupp, swRevMain, serial, serial, serial, serial);
-}
-
-ANTMessage PowerDevice::page01()
-{
-    const unsigned char page = 0x01; // page 01
-    const unsigned char success = 0xAC;
-
-    return ANTMessage(9, ANT_BROADCAST_DATA, m_channel, page, success, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00);
-}
-
-void PowerDevice::handleAckData(unsigned char *ant_message)
-{
-
-    // byte 0 sync
-    // byte 1 len
-    // byte 2 type (channel event 0x40 if we get it here)
-    // byte 3 channel number
-    // byte 4 message id
-
-    if (! (ant_message[2] == 0x4F))
-    {
-        qDebug() << "PowerDevice::handleAckData() called with wrong message type";
-        return;
-    }
-
-    // Make sure we're the right channel
-    if (! (ant_message[3] == m_channel))
-    {
-        qDebug() << "PowerDevice::handleAckData() called with wrong channel";
-        return;
-    }
-
     switch (ant_message[4]) {
     case 0x01: // calibration
         {
-            ANTMessage m = page01();
-            m_usb->write((char*)m.data, m.length);
+            const ANTMessage &m = page01();
+            m_tx->send(m, ANTTransmitter::Command);
         }
         break;
 
-    case 0x46: // Request for a special page, should not be needed.
-    {
-        //unsigned char * ant_sport_mess = ant_message+4;
-        //handlePageRequest(ant_sport_mess);
-        break;
-    }
     default:
         qDebug() << __func__ << "Unhandled" << ant_message[4] ;
     }
@@ -221,21 +91,3 @@ void PowerDevice::setCurrentPower(quint16 power)
 {
     m_power = power;
 }
-
-void PowerDevice::configureChannel()
-{
-    ANTMessage assignCh = ANTMessage::assignChannel(m_channel, 0x10, 0);
-    m_usb->write((char *)assignCh.data,assignCh.length);
-
-    ANTMessage id = ANTMessage::setChannelID(m_channel, m_deviceId, 0x0B, 0x05);
-    m_usb->write((char *)id.data, id.length);
-
-    ANTMessage chanPeriod = ANTMessage::setChannelPeriod(m_channel,8182);
-    m_usb->write((char *)chanPeriod.data, chanPeriod.length);
-
-    ANTMessage chanFreq = ANTMessage::setChannelFreq(m_channel, 57); // 57 ANT Sport
-    m_usb->write((char *)chanFreq.data, chanFreq.length);
-
-    ANTMessage openChan = ANTMessage::open(m_channel);
-    m_usb->write((char *)openChan.data, openChan.length);
-}
@@ -21,39 +21,48 @@
 
 #include <QObject>
 #include "antmessage.h"
-#include "antdevice.h"
+#include "antprofile.h"
 
-class LibUsb;
 
-class PowerDevice :  public QObject, public ANTDevice
+class PowerDevice :  public QObject, public ANTProfile<PowerDevice>
 {
     Q_OBJECT
 public:
-    explicit PowerDevice(LibUsb * usb, const unsigned char channel, unsigned short deviceId, QObject *parent = 0);
+    // ANT+ bicycle power, 0x10 x 60 then 0x50 or 0x51
+    static const unsigned char DeviceType = 0x0B;
+    static const unsigned char TransmissionType = 0x05;
+    static const unsigned char Network = 0;
+    static const unsigned short Period = 8182;
+    static const bool FixedPeriod = true;
+    static const bool FixedFrequency = true;
+    static const int MainPageCount = 60;
+    static const int CommonPageRepeat = 1;
+    static QVector<int> pagePattern() {return QVector<int>() << 16;}
+    static const char *name() {return "PowerDevice";}
 
-    ANTMessage page16();
-    ANTMessage page80();
-    ANTMessage page81();
-    ANTMessage page01(); // calibration response
+    explicit PowerDevice(ANTTransmitter * tx, const unsigned char channel, unsigned short deviceId, QObject *parent = 0);
 
-    void configureChannel();
+    const ANTMessage &encodePage(int page);
+    void handleAckPage(unsigned char *ant_message);
+
+    const ANTMessage &page16();
+    const ANTMessage &page01(); // calibration response
 
-    void handleAckData(unsigned char *ant_message);
-    int channel() const {return m_channel;}
 signals:
 
 public slots:
-    void channelEvent(unsigned char *ant_message);
-    void sendNextPage();
     void setCurrentPower(quint16 power);
     void setCurrentCadence(quint8 cadence);
 
 private:
-    LibUsb *m_usb;
-    unsigned char m_channel;
     quint16 m_power;
     unsigned char m_cadence;
-    unsigned short m_deviceId;
+    unsigned char m_eventCount;
+    unsigned short m_accuPower;
+
+    // pre-encoded pages, only the variable fields are patched before sending
+    ANTMessage m_page16;
+    ANTMessage m_page01;
 };
 
 #endif // POWERDEVICE_H
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "rfsurvey.h"
+#include <QDebug>
+#include <algorithm>
+#include "anttransmitter.h"
+
+// packets heard without an rssi count as a neighbour at about -70dBm
+#define RF_SURVEY_DEFAULT_WEIGHT 30
+
+RFSurvey::RFSurvey(ANTTransmitter *tx, const unsigned char channel) :
+    m_tx(tx),
+    m_channel(channel),
+    m_network(0),
+    m_current(0)
+{
+}
+
+QVector<unsigned char> RFSurvey::candidates()
+{
+    // 2424-2425 and 2449-2450 MHz fall between Wi-Fi channels 1, 6 and 11,
+    // 2474-2480 MHz is above 11 and still in the band
+    return QVector<unsigned char>() << 24 << 25 << 49 << 50 << 74 << 76 << 78 << 80;
+}
+
+void RFSurvey::start(unsigned char network)
+{
+    m_network = network;
+    m_current = 0;
+
+    // Slave channel with a wildcard channel id so every master on the network matches
+    ANTMessage assignCh = ANTMessage::assignChannel(m_channel, 0x00, m_network);
+    m_tx->send(assignCh, ANTTransmitter::Command);
+
+    ANTMessage id = ANTMessage::setChannelID(m_channel, 0, 0, 0);
+    m_tx->send(id, ANTTransmitter::Command);
+
+    ANTMessage openScan = ANTMessage::openRxScanMode();
+    m_tx->send(openScan, ANTTransmitter::Command);
+}
+
+RFSurvey::Tally &RFSurvey::tally(unsigned char frequency)
+{
+    for (int i = 0; i < m_tallies.size(); ++i)
+    {
+        if (m_tallies[i].result.frequency == frequency)
+            return m_tallies[i];
+    }
+
+    Tally t;
+    t.result.frequency = frequency;
+    t.result.packets = 0;
+    t.result.meanRssi = 0;
+    t.result.score = 0;
+    t.rssiSum = 0;
+    t.rssiCount = 0;
+    m_tallies.append(t);
+    return m_tallies.last();
+}
+
+void RFSurvey::tune(unsigned char frequency)
+{
+    ANTMessage chanFreq = ANTMessage::setChannelFreq(m_channel, frequency);
+    m_tx->send(chanFreq, ANTTransmitter::Command);
+
+    // packets still in flight from the last frequency count against it
+    m_current = &tally(frequency);
+}
+
+void RFSurvey::stop()
+{
+    m_current = 0;
+
+    ANTMessage closeChan = ANTMessage::close(m_channel);
+    m_tx->send(closeChan, ANTTransmitter::Command);
+
+    ANTMessage unassign = ANTMessage::unassignChannel(m_channel);
+    m_tx->send(unassign, ANTTransmitter::Command);
+}
+
+static bool quieter(const RFSurvey::Result &a, const RFSurvey::Result &b)
+{
+    return a.score < b.score;
+}
+
+QVector<RFSurvey::Result> RFSurvey::results() const
+{
+    QVector<Result> ranked;
+    foreach (const Tally &t, m_tallies)
+    {
+        Result result = t.result;
+        if (t.rssiCount)
+            result.meanRssi = t.rssiSum / t.rssiCount;
+        ranked.append(result);
+    }
+
+    // stable, so ties keep the candidate order
+    std::stable_sort(ranked.begin(), ranked.end(), quieter);
+    return ranked;
+}
+
+void RFSurvey::channelEvent(unsigned char *ant_message)
+{
+    // responses to our own commands and EVENT_CHANNEL_CLOSED, nothing to measure
+    Q_UNUSED(ant_message);
+}
+
+void RFSurvey::handleAckData(unsigned char *ant_message)
+{
+    heard(ant_message);
+}
+
+void RFSurvey::handleBroadcastData(unsigned char *ant_message)
+{
+    heard(ant_message);
+}
+
+void RFSurvey::heard(unsigned char *ant_message)
+{
+    if (!m_current)
+        return;
+
+    int weight = RF_SURVEY_DEFAULT_WEIGHT;
+
+    ANTExtendedData ext;
+    if (ANTMessage::parseExtendedData(ant_message, ext) && (ext.flags & ANT_EXT_FLAG_RSSI))
+    {
+        // -100dBm is at the edge of reception, -40dBm is right next to us
+        weight = qBound(1, ext.rssi + 100, 60);
+        m_current->rssiSum += ext.rssi;
+        m_current->rssiCount++;
+    }
+
+    m_current->result.packets++;
+    m_current->result.score += weight;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef RFSURVEY_H
+#define RFSURVEY_H
+
+#include <QVector>
+#include "antmessage.h"
+#include "antdevice.h"
+
+class ANTTransmitter;
+
+// time spent listening on each candidate frequency
+#define RF_SURVEY_DWELL_MS 500
+
+/*
+ * Measures how busy a set of RF channels are by listening on each in turn
+ * with a wildcard slave channel in continuous scan mode. Every packet heard
+ * counts against its frequency, weighted by how strong it was, so a
+ * neighbour's bridge across the room costs more than one down the hall.
+ *
+ * The stick only reports packets sent with a network key it knows, so a
+ * survey is run once per network, ANT+ and our private one, and the counts
+ * for a frequency add up over all of them. Wi-Fi goes unseen, the
+ * candidates sit in the gaps between Wi-Fi channels 1, 6 and 11 and above
+ * 11 to make up for that, and stay clear of the ANT+ frequency.
+ *
+ * Scan mode takes over the radio, ANTStick runs a survey before it opens
+ * the transmitting channels.
+ */
+class RFSurvey : public ANTDevice
+{
+public:
+    struct Result {
+        unsigned char frequency;
+        int packets;
+        int meanRssi; // dBm, 0 when nothing was heard
+        int score;    // lower is quieter
+    };
+
+    RFSurvey(ANTTransmitter *tx, const unsigned char channel);
+
+    static QVector<unsigned char> candidates();
+
+    void start(unsigned char network); // open the scan channel, call tune() next
+    void tune(unsigned char frequency); // ends the measurement of the previous frequency
+    void stop();
+
+    QVector<Result> results() const; // quietest first
+
+    int channel() const {return m_channel;}
+    void configureChannel() {start(m_network);}
+    void channelEvent(unsigned char *ant_message);
+    void handleAckData(unsigned char *ant_message);
+    void handleBroadcastData(unsigned char *ant_message);
+    void setCurrentPower(quint16 power) {Q_UNUSED(power);}
+    void setCurrentCadence(quint8 cadence) {Q_UNUSED(cadence);}
+
+private:
+    struct Tally {
+        Result result;
+        int rssiSum;
+        int rssiCount;
+    };
+
+    void heard(unsigned char *ant_message);
+    Tally &tally(unsigned char frequency);
+
+    ANTTransmitter *m_tx;
+    unsigned char m_channel;
+    unsigned char m_network;
+    Tally *m_current; // 0 until tune()
+    QVector<Tally> m_tallies; // in the order first tuned
+};
+
+#endif // RFSURVEY_H
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "telemetrydevice.h"
+#include <QDebug>
+
+bool TelemetryDevice::networkKey(unsigned char key[ANT_KEY_LENGTH])
+{
+    // The lab's private network key as 16 hex digits. Both ends must agree
+    // on it, ANT+ head units won't see the channel at all.
+    const QByteArray value = qgetenv("ANT_TELEMETRY_KEY");
+    if (value.isEmpty())
+        return false;
+
+    if (value.size() != 2 * ANT_KEY_LENGTH)
+    {
+        qDebug() << "TelemetryDevice: ANT_TELEMETRY_KEY must be" << 2 * ANT_KEY_LENGTH << "hex digits";
+        return false;
+    }
+
+    for (int i = 0; i < ANT_KEY_LENGTH; ++i)
+    {
+        bool ok;
+        key[i] = value.mid(2 * i, 2).toInt(&ok, 16);
+        if (!ok)
+        {
+            qDebug() << "TelemetryDevice: ANT_TELEMETRY_KEY must be" << 2 * ANT_KEY_LENGTH << "hex digits";
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned char TelemetryDevice::frequency()
+{
+    const QByteArray value = qgetenv("ANT_TELEMETRY_FREQ");
+    if (value.isEmpty())
+        return ANT_SPORT_FREQUENCY;
+
+    bool ok;
+    const int frequency = value.toInt(&ok);
+    if (!ok || frequency < 0 || frequency > ANT_MAX_FREQUENCY)
+    {
+        qDebug() << "TelemetryDevice: ignoring ANT_TELEMETRY_FREQ" << value << ", expected 0 -" << ANT_MAX_FREQUENCY;
+        return ANT_SPORT_FREQUENCY;
+    }
+    return frequency;
+}
+
+static unsigned short checkedPeriod(unsigned short period)
+{
+    if (period < 32768 / 16 || period > 32768 / 8)
+    {
+        qDebug() << "TelemetryDevice: rate" << 32768 / period << "Hz out of range, using 16Hz";
+        return 32768 / 16;
+    }
+    return period;
+}
+
+int TelemetryDevice::sampleRate()
+{
+    const ChannelConfig config = ChannelConfig::load(name(), Period, FixedPeriod, pagePattern(),
+                                                     MainPageCount, CommonPageRepeat);
+    return 32768 / checkedPeriod(config.period);
+}
+
+TelemetryDevice::TelemetryDevice(ANTTransmitter *tx, const unsigned char channel, unsigned short deviceId, int rateHz, QObject *parent) : QObject(parent),
+    ANTProfile<TelemetryDevice>(tx, channel, deviceId),
+    m_power(0),
+    m_cadence(0),
+    m_sampleTime(0),
+    m_sequence(0),
+    m_accuPower(0)
+{
+    // channel period is in 1/32768s, an explicit rate wins over ANT_RATE_TELEMETRY
+    if (rateHz > 0)
+        setChannelPeriod(32768 / rateHz);
+
+    setChannelPeriod(checkedPeriod(channelPeriod()));
+    setChannelFrequency(frequency());
+
+    m_timer.start();
+
+    m_page = ANTMessage(9, ANT_BROADCAST_DATA, m_channel, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+
+const ANTMessage &TelemetryDevice::encodePage(int page)
+{
+    Q_UNUSED(page);
+    return telemetryPage();
+}
+
+const ANTMessage &TelemetryDevice::telemetryPage()
+{
+    m_page.setPageByte(0, m_sequence);
+    m_page.setPageByte(1, m_sampleTime & 0xFF);
+    m_page.setPageByte(2, m_sampleTime >> 8);
+    m_page.setPageByte(3, m_power & 0xFF);
+    m_page.setPageByte(4, m_power >> 8);
+    m_page.setPageByte(5, m_cadence);
+    m_page.setPageByte(6, m_accuPower & 0xFF);
+    m_page.setPageByte(7, m_accuPower >> 8);
+
+    return m_page;
+}
+
+void TelemetryDevice::handleAckPage(unsigned char *ant_message)
+{
+    // nothing is controllable over the telemetry channel
+    Q_UNUSED(ant_message);
+}
+
+void TelemetryDevice::setCurrentPower(quint16 power)
+{
+    // timestamp the sample when it arrives rather than when it's sent
+    m_sampleTime = (m_timer.nsecsElapsed() * 1024 / 1000000000) & 0xFFFF;
+    m_sequence++;
+    m_power = power;
+    m_accuPower += power;
+}
+
+void TelemetryDevice::setCurrentCadence(quint8 cadence)
+{
+    m_cadence = cadence;
+}
+
+TelemetryDecoder::TelemetryDecoder()
+{
+    reset();
+}
+
+void TelemetryDecoder::reset()
+{
+    m_first = true;
+    m_lastSequence = 0;
+    m_received = 0;
+    m_repeated = 0;
+    m_lost = 0;
+}
+
+bool TelemetryDecoder::decode(const unsigned char *payload, Sample &sample)
+{
+    sample.sequence = payload[0];
+    sample.timestamp = payload[1] | (payload[2] << 8);
+    sample.power = payload[3] | (payload[4] << 8);
+    sample.cadence = payload[5];
+    sample.accumulatedPower = payload[6] | (payload[7] << 8);
+
+    if (!m_first)
+    {
+        // a broadcast that went out before the next sample
+        const unsigned char gap = sample.sequence - m_lastSequence;
+        if (gap == 0)
+        {
+            m_repeated++;
+            return false;
+        }
+
+        // anything between the last sequence number and this one never made it
+        m_lost += gap - 1;
+    }
+
+    m_first = false;
+    m_lastSequence = sample.sequence;
+    m_received++;
+
+    return true;
+}
+
+double TelemetryDecoder::lossRate() const
+{
+    const quint32 total = m_received + m_lost;
+    return total ? double(m_lost) / total : 0.0;
+}
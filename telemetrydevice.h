@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TELEMETRYDEVICE_H
+#define TELEMETRYDEVICE_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include "antmessage.h"
+#include "antprofile.h"
+
+
+#define TELEMETRY_NETWORK     1
+#define TELEMETRY_DEVICE_TYPE 0x7F
+
+/*
+ * Private (non ANT+) channel broadcasting raw power and cadence samples at
+ * 8-16Hz for lab analysis. Every broadcast uses the same 8 byte layout:
+ *
+ * byte 0   sample sequence number, wraps at 256
+ * byte 1-2 sample timestamp in 1/1024s, wraps after 64s
+ * byte 3-4 instantaneous power (W)
+ * byte 5   cadence (rpm)
+ * byte 6-7 accumulated power (W), wraps at 65536
+ *
+ * The sequence number moves with the samples, not the broadcasts, so a
+ * broadcast that goes out before the next sample repeats the previous one.
+ * The bike is polled at sampleRate() to keep the two in step.
+ */
+class TelemetryDevice : public QObject, public ANTProfile<TelemetryDevice>
+{
+    Q_OBJECT
+public:
+    // a single page over and over, no common pages
+    static const unsigned char DeviceType = TELEMETRY_DEVICE_TYPE;
+    static const unsigned char TransmissionType = 0x01;
+    static const unsigned char Network = TELEMETRY_NETWORK;
+    static const unsigned short Period = 2048;
+    static const bool FixedPeriod = false;
+    static const bool FixedFrequency = false;
+    static const int MainPageCount = 1;
+    static const int CommonPageRepeat = 0;
+    static QVector<int> pagePattern() {return QVector<int>() << 0;}
+    static const char *name() {return "TelemetryDevice";}
+
+    explicit TelemetryDevice(ANTTransmitter * tx, const unsigned char channel, unsigned short deviceId, int rateHz = 0, QObject *parent = 0);
+
+    // private key from ANT_TELEMETRY_KEY, false if it isn't set
+    static bool networkKey(unsigned char key[ANT_KEY_LENGTH]);
+
+    // RF frequency in MHz above 2400 from ANT_TELEMETRY_FREQ, the ANT+ one
+    // if it isn't set. Receivers have to be tuned to the same.
+    static unsigned char frequency();
+
+    // broadcast rate in Hz after ANT_RATE_TELEMETRY and range checking
+    static int sampleRate();
+
+    const ANTMessage &encodePage(int page);
+    void handleAckPage(unsigned char *ant_message);
+
+    const ANTMessage &telemetryPage();
+
+public slots:
+    void setCurrentPower(quint16 power);
+    void setCurrentCadence(quint8 cadence);
+
+private:
+    QElapsedTimer m_timer;
+    quint16 m_power;
+    unsigned char m_cadence;
+    quint16 m_sampleTime;
+    unsigned char m_sequence;
+    unsigned short m_accuPower;
+    ANTMessage m_page;
+};
+
+/*
+ * Receiver side of the telemetry channel, decodes the payload of a broadcast
+ * and keeps track of lost samples from the sequence numbers. A broadcast
+ * repeating the previous sample is counted but not returned.
+ */
+class TelemetryDecoder
+{
+public:
+    struct Sample {
+        unsigned char sequence;
+        quint16 timestamp; // 1/1024s
+        quint16 power;
+        quint8 cadence;
+        quint16 accumulatedPower;
+    };
+
+    TelemetryDecoder();
+
+    // false for a repeat of the sample decoded last
+    bool decode(const unsigned char *payload, Sample &sample);
+    void reset();
+
+    quint32 received() const {return m_received;}
+    quint32 repeated() const {return m_repeated;}
+    quint32 lost() const {return m_lost;}
+    double lossRate() const;
+
+private:
+    bool m_first;
+    unsigned char m_lastSequence;
+    quint32 m_received;
+    quint32 m_repeated;
+    quint32 m_lost;
+};
+
+#endif // TELEMETRYDEVICE_H
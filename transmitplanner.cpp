@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "transmitplanner.h"
+#include <QDebug>
+
+// number of candidate offsets tried per period
+#define PLANNER_STEPS 256
+
+// closest a drifting pair may be opened, 1/32768s
+#define PLANNER_DRIFT_GUARD 64
+
+// time since the epoch in 1/32768 s. Microseconds first, the nanoseconds
+// times 32768 would overflow after three days of uptime.
+static qint64 ticks(const QElapsedTimer &epoch)
+{
+    return epoch.nsecsElapsed() / 1000 * 32768 / 1000000;
+}
+
+static unsigned short gcd(unsigned short a, unsigned short b)
+{
+    while (b) {
+        unsigned short t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+TransmitPlanner::TransmitPlanner()
+{
+    m_epoch.start();
+}
+
+TransmitPlanner *TransmitPlanner::instance()
+{
+    static TransmitPlanner planner;
+    return &planner;
+}
+
+int TransmitPlanner::find(int stick, unsigned char channel) const
+{
+    for (int i = 0; i < m_channels.size(); ++i)
+    {
+        if (m_channels[i].stick == stick && m_channels[i].channel == channel)
+            return i;
+    }
+    return -1;
+}
+
+unsigned short TransmitPlanner::harmonicPeriod(unsigned short period) const
+{
+    // Pick base/n closest to the requested period, base being the longest
+    // period already planned
+    unsigned short base = 0;
+    foreach (const Channel &c, m_channels)
+    {
+        if (c.period > base) base = c.period;
+    }
+
+    if (base == 0 || period >= base) return period;
+
+    unsigned short best = base;
+    for (int n = 2; base / n >= period / 2; ++n)
+    {
+        if (base % n) continue;
+        if (qAbs(int(base / n) - int(period)) < qAbs(int(best) - int(period)))
+            best = base / n;
+    }
+
+    return best;
+}
+
+int TransmitPlanner::placeOffset(unsigned short period) const
+{
+    // Two channels with periods p and q only ever transmit at offsets that
+    // differ by a multiple of gcd(p, q), so the closest they get is the
+    // distance between their offsets modulo that. Pick the offset where the
+    // closest neighbour is furthest away.
+    //
+    // Pairs with a small gcd (8182 and 8192) slide through each other by
+    // |p - q| every period whatever the offsets are, so how often they meet
+    // is fixed. What the planner can pick is where in that cycle they start:
+    // just clear of the other channel on the side it's moving away from,
+    // which puts off the first meeting for as long as possible.
+    const qint64 now = ticks(m_epoch);
+
+    int bestOffset = 0;
+    int bestDistance = -1;
+
+    for (int step = 0; step < PLANNER_STEPS; ++step)
+    {
+        const int offset = step * period / PLANNER_STEPS;
+        int distance = period;
+
+        foreach (const Channel &c, m_channels)
+        {
+            int g = gcd(period, c.period);
+            int d = (offset - c.offset) % g;
+
+            if (g < period / 64)
+            {
+                // drifting pair, gap from the other's next transmission to ours
+                qint64 next = (offset - now) % period;
+                if (next < 0) next += period;
+                qint64 other = (c.offset - now) % c.period;
+                if (other < 0) other += c.period;
+
+                g = qMin(period, c.period);
+                int gap = (next - other) % g;
+                if (gap < 0) gap += g;
+
+                // the gap grows by period - c.period every period, the
+                // distance left to travel is how long until they meet
+                if (qMin(gap, g - gap) < PLANNER_DRIFT_GUARD)
+                    d = qMin(gap, g - gap);
+                else
+                    d = period > c.period ? g - gap : gap;
+                distance = qMin(distance, d);
+                continue;
+            }
+
+            if (d < 0) d += g;
+            distance = qMin(distance, qMin(d, g - d));
+        }
+
+        if (distance > bestDistance)
+        {
+            bestDistance = distance;
+            bestOffset = offset;
+        }
+    }
+
+    return bestOffset;
+}
+
+unsigned short TransmitPlanner::addChannel(int stick, unsigned char channel, unsigned short period, bool fixedPeriod)
+{
+    QMutexLocker locker(&m_mutex);
+
+    int index = find(stick, channel);
+    if (index >= 0)
+        m_channels.remove(index);
+
+    Channel c;
+    c.stick = stick;
+    c.channel = channel;
+    c.period = period;
+    c.offset = 0;
+
+#ifndef DISABLE_TX_PLANNER
+    if (!fixedPeriod)
+        c.period = harmonicPeriod(period);
+    c.offset = placeOffset(c.period);
+#else
+    Q_UNUSED(fixedPeriod);
+#endif
+
+    qDebug() << "TransmitPlanner: stick" << stick << "channel" << channel
+             << "period" << c.period << "offset" << c.offset;
+
+    m_channels.append(c);
+    return c.period;
+}
+
+void TransmitPlanner::removeStick(int stick)
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (int i = m_channels.size() - 1; i >= 0; --i)
+    {
+        if (m_channels[i].stick == stick)
+            m_channels.remove(i);
+    }
+}
+
+int TransmitPlanner::openDelay(int stick, unsigned char channel)
+{
+#ifdef DISABLE_TX_PLANNER
+    Q_UNUSED(stick);
+    Q_UNUSED(channel);
+    return 0;
+#else
+    QMutexLocker locker(&m_mutex);
+
+    int index = find(stick, channel);
+    if (index < 0) return 0;
+
+    const Channel &c = m_channels[index];
+    const qint64 now = ticks(m_epoch);
+
+    qint64 wait = (c.offset - now) % c.period;
+    if (wait < 0) wait += c.period;
+
+    return wait * 1000 / 32768;
+#endif
+}
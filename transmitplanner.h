@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TRANSMITPLANNER_H
+#define TRANSMITPLANNER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+
+/*
+ * Spreads the transmissions of all master channels in the process over time
+ * so they don't go on air at the same moment. ANT has no way of setting the
+ * phase of a channel directly, it's given by when the channel is opened, so
+ * every channel gets an offset (in 1/32768s) against a common epoch and is
+ * opened when that offset comes around.
+ *
+ * Channels whose periods share a large common divisor (8192 and 4096, say)
+ * keep their spacing for ever on one stick. Periods like 8182 and 8192 drift
+ * through each other no matter what, those pairs are opened so that their
+ * first meeting comes as late as possible. Between sticks the crystals drift
+ * slowly, so the spacing there only holds for a while after opening.
+ *
+ * The plan lives in this process only, bridges running in separate
+ * processes don't see each other's channels.
+ */
+class TransmitPlanner
+{
+public:
+    static TransmitPlanner *instance();
+
+    // Place a channel, returns the period it should use. Channels without a
+    // fixed (profile mandated) period are snapped to a harmonic of the other
+    // channels so they can be kept apart.
+    unsigned short addChannel(int stick, unsigned char channel, unsigned short period, bool fixedPeriod);
+    void removeStick(int stick);
+
+    // ms to wait before opening the channel to hit its slot
+    int openDelay(int stick, unsigned char channel);
+
+private:
+    TransmitPlanner();
+
+    struct Channel {
+        int stick;
+        unsigned char channel;
+        unsigned short period;
+        int offset;
+    };
+
+    int find(int stick, unsigned char channel) const;
+    int placeOffset(unsigned short period) const;
+    unsigned short harmonicPeriod(unsigned short period) const;
+
+    QMutex m_mutex;
+    QElapsedTimer m_epoch;
+    QVector<Channel> m_channels;
+};
+
+#endif // TRANSMITPLANNER_H
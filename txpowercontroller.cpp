@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "txpowercontroller.h"
+#include <QDebug>
+#include <QByteArray>
+
+TxPowerController::TxPowerController(int stickIndex) :
+    m_stickIndex(stickIndex),
+    m_enabled(false),
+    m_level(ANT_TX_POWER_LEVEL_DEFAULT)
+{
+    const QByteArray value = qgetenv("ANT_TX_POWER");
+    if (value.isEmpty())
+        return;
+
+    bool ok;
+    const int level = value.toInt(&ok);
+
+    if (!ok || level < ANT_TX_POWER_LEVEL_MIN || level > ANT_TX_POWER_LEVEL_MAX)
+    {
+        qDebug() << "TxPowerController: ignoring ANT_TX_POWER" << value << ", expected a level in"
+                 << ANT_TX_POWER_LEVEL_MIN << "-" << ANT_TX_POWER_LEVEL_MAX;
+        return;
+    }
+
+    qDebug() << "TxPowerController: stick" << m_stickIndex << "power level" << level;
+
+    m_enabled = true;
+    m_level = level;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef TXPOWERCONTROLLER_H
+#define TXPOWERCONTROLLER_H
+
+#include <QtGlobal>
+#include "antmessage.h"
+
+/*
+ * Picks the transmit power of a stick. ANT_TX_POWER in the environment sets
+ * it in ANT_TX_POWER_LEVEL_* steps, without it the stick default is left
+ * alone.
+ *
+ * The level is fixed. A broadcast channel has nothing that tells it whether
+ * the head unit still hears it, acknowledged transfers only happen on the
+ * odd page request, far too rarely to steer the power by.
+ */
+class TxPowerController
+{
+public:
+    explicit TxPowerController(int stickIndex);
+
+    bool enabled() const {return m_enabled;}
+    unsigned char level() const {return m_level;}
+
+private:
+    int m_stickIndex;
+    bool m_enabled;
+    unsigned char m_level;
+};
+
+#endif // TXPOWERCONTROLLER_H
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "virtualstick.h"
+#include <QMutexLocker>
+#include <QDebug>
+#include <errno.h>
+
+// read() gives up after this long without data, same as the usb read
+#define VIRTUAL_STICK_READ_TIMEOUT_MS 125
+
+VirtualStick::VirtualStick() :
+    m_present(true),
+    m_opened(false)
+{
+    memset(m_channels, 0, sizeof(m_channels));
+    m_clock.start();
+}
+
+int VirtualStick::open(const QString &stickId)
+{
+    Q_UNUSED(stickId);
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_present)
+        return -ENODEV;
+
+    // a freshly opened stick has nothing configured
+    memset(m_channels, 0, sizeof(m_channels));
+    m_out.clear();
+    m_in.clear();
+    m_opened = true;
+    return 0;
+}
+
+void VirtualStick::close()
+{
+    QMutexLocker locker(&m_mutex);
+    m_opened = false;
+    m_dataReady.wakeAll();
+}
+
+void VirtualStick::setPresent(bool present)
+{
+    QMutexLocker locker(&m_mutex);
+    m_present = present;
+    m_dataReady.wakeAll();
+}
+
+int VirtualStick::read(char *buf, int bytes)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const qint64 timeout = m_clock.nsecsElapsed() + qint64(VIRTUAL_STICK_READ_TIMEOUT_MS) * 1000000;
+
+    while (m_out.isEmpty())
+    {
+        if (!m_present || !m_opened)
+            return -ENODEV;
+
+        const qint64 now = m_clock.nsecsElapsed();
+        runChannels(now);
+        if (!m_out.isEmpty())
+            break;
+
+        const qint64 deadline = qMin(timeout, nextDeadline());
+        if (now >= timeout)
+            return -ETIMEDOUT;
+
+        m_dataReady.wait(&m_mutex, (unsigned long)((deadline - now + 999999) / 1000000));
+    }
+
+    const int count = qMin(bytes, m_out.size());
+    memcpy(buf, m_out.constData(), count);
+    m_out.remove(0, count);
+    return count;
+}
+
+int VirtualStick::write(char *buf, int bytes)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_present || !m_opened)
+        return -ENODEV;
+
+    m_in.append(buf, bytes);
+
+    // there may be several frames, or the start of one
+    while (m_in.size() >= 4)
+    {
+        if ((unsigned char)m_in[0] != ANT_SYNC_BYTE)
+        {
+            m_in.remove(0, 1);
+            continue;
+        }
+
+        const int length = (unsigned char)m_in[1] + 4;
+        if (length > ANT_MAX_MESSAGE_SIZE)
+        {
+            m_in.remove(0, 1);
+            continue;
+        }
+
+        if (m_in.size() < length)
+            break;
+
+        unsigned char checksum = 0;
+        for (int i = 0; i < length; ++i)
+            checksum ^= (unsigned char)m_in[i];
+
+        if (checksum == 0)
+            handleMessage((const unsigned char *)m_in.constData());
+        else
+            qDebug() << "VirtualStick: dropping frame with bad checksum";
+
+        m_in.remove(0, length);
+    }
+
+    m_dataReady.wakeAll();
+    return bytes;
+}
+
+void VirtualStick::handleMessage(const unsigned char *message)
+{
+    const unsigned char id = message[ANT_OFFSET_ID];
+    const unsigned char channel = message[ANT_OFFSET_DATA];
+    Channel *c = channel < VIRTUAL_STICK_CHANNELS ? &m_channels[channel] : 0;
+
+    switch (id)
+    {
+    case ANT_BROADCAST_DATA:
+    case ANT_ACK_DATA:
+        // goes out in the channel's next slot
+        if (c)
+            c->pendingAck = (id == ANT_ACK_DATA);
+        return;
+
+    case ANT_REQ_MESSAGE:
+        if (message[ANT_OFFSET_DATA + 1] == ANT_CAPABILITIES)
+        {
+            // channels, networks, standard options, advanced options (extended messages, per channel tx power)
+            const unsigned char caps[6] = {VIRTUAL_STICK_CHANNELS, VIRTUAL_STICK_NETWORKS, 0x00, 0x02 | ANT_CAPS_PER_CHANNEL_TX_POWER, 0x00, 0x00};
+            queueMessage(ANT_CAPABILITIES, caps, sizeof(caps));
+        }
+        else
+        {
+            respond(channel, ANT_REQ_MESSAGE, INVALID_MESSAGE);
+        }
+        return;
+
+    case ANT_SYSTEM_RESET:
+    {
+        memset(m_channels, 0, sizeof(m_channels));
+        const unsigned char reason = 0x20; // command reset
+        queueMessage(ANT_NOTIF_STARTUP, &reason, 1);
+        return;
+    }
+
+    case ANT_SET_NETWORK:
+    case ANT_LIB_CONFIG:
+    case ANT_ENABLE_EXT_MSGS:
+    case ANT_TX_POWER:
+        // not channel specific, byte 3 is a network number or zero
+        respond(channel, id, RESPONSE_NO_ERROR);
+        return;
+
+    default:
+        break;
+    }
+
+    if (!c)
+    {
+        respond(channel, id, INVALID_MESSAGE);
+        return;
+    }
+
+    switch (id)
+    {
+    case ANT_ASSIGN_CHANNEL:
+        c->assigned = true;
+        c->master = (message[ANT_OFFSET_DATA + 1] & 0x10) != 0;
+        c->period = 8192;
+        break;
+    case ANT_UNASSIGN_CHANNEL:
+        memset(c, 0, sizeof(*c));
+        break;
+    case ANT_CHANNEL_PERIOD:
+        c->period = message[ANT_OFFSET_DATA + 1] | (message[ANT_OFFSET_DATA + 2] << 8);
+        break;
+    case ANT_OPEN_CHANNEL:
+    case ANT_OPEN_RX_SCAN_CH:
+        if (!c->assigned)
+        {
+            respond(channel, id, CHANNEL_IN_WRONG_STATE);
+            return;
+        }
+        c->open = true;
+        c->nextEvent = m_clock.nsecsElapsed() + qint64(c->period) * 1000000000 / 32768;
+        break;
+    case ANT_CLOSE_CHANNEL:
+        c->open = false;
+        respond(channel, id, RESPONSE_NO_ERROR);
+        respond(channel, 1, EVENT_CHANNEL_CLOSED);
+        return;
+    default:
+        // channel id, frequency, search timeout, tx power and the like only need acknowledging
+        break;
+    }
+
+    respond(channel, id, RESPONSE_NO_ERROR);
+}
+
+void VirtualStick::respond(unsigned char channel, unsigned char messageId, unsigned char code)
+{
+    const unsigned char data[3] = {channel, messageId, code};
+    queueMessage(ANT_CHANNEL_EVENT, data, sizeof(data));
+}
+
+void VirtualStick::queueMessage(unsigned char id, const unsigned char *data, int length)
+{
+    unsigned char checksum = ANT_SYNC_BYTE ^ length ^ id;
+    m_out.append(char(ANT_SYNC_BYTE));
+    m_out.append(char(length));
+    m_out.append(char(id));
+    for (int i = 0; i < length; ++i)
+    {
+        m_out.append(char(data[i]));
+        checksum ^= data[i];
+    }
+    m_out.append(char(checksum));
+}
+
+void VirtualStick::runChannels(qint64 now)
+{
+    for (int ch = 0; ch < VIRTUAL_STICK_CHANNELS; ++ch)
+    {
+        Channel &c = m_channels[ch];
+        if (!c.open || !c.master || now < c.nextEvent)
+            continue;
+
+        // one slot per call, a late reader sees the missed ones one by one
+        c.nextEvent += qint64(c.period) * 1000000000 / 32768;
+
+        // an acknowledged message takes the slot instead of EVENT_TX, after
+        // that the channel repeats it as a broadcast until the host sends
+        // something new
+        respond(ch, 1, c.pendingAck ? EVENT_TRANSFER_TX_COMPLETED : EVENT_TX);
+        c.pendingAck = false;
+    }
+}
+
+qint64 VirtualStick::nextDeadline() const
+{
+    qint64 deadline = m_clock.nsecsElapsed() + qint64(VIRTUAL_STICK_READ_TIMEOUT_MS) * 1000000;
+
+    for (int ch = 0; ch < VIRTUAL_STICK_CHANNELS; ++ch)
+    {
+        const Channel &c = m_channels[ch];
+        if (c.open && c.master)
+            deadline = qMin(deadline, c.nextEvent);
+    }
+
+    return deadline;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2016 Erik Botö (erik.boto@gmail.com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef VIRTUALSTICK_H
+#define VIRTUALSTICK_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include "anttransport.h"
+#include "antmessage.h"
+
+#define VIRTUAL_STICK_CHANNELS     8
+#define VIRTUAL_STICK_NETWORKS     8
+
+/*
+ * A software ANT stick behind the transport interface, for running the
+ * bridge without hardware. It acknowledges configuration commands, answers
+ * capability requests and raises EVENT_TX on every open master channel at
+ * its channel period, or EVENT_TRANSFER_TX_COMPLETED in the slot of an
+ * acknowledged message.
+ */
+class VirtualStick : public ANTTransport
+{
+public:
+    VirtualStick();
+
+    int open(const QString &stickId);
+    void close();
+    int read(char *buf, int bytes);
+    int write(char *buf, int bytes);
+
+    // pulling the stick makes reads and writes fail with -ENODEV
+    void setPresent(bool present);
+
+private:
+    struct Channel {
+        bool assigned;
+        bool master;
+        bool open;
+        unsigned short period;
+        qint64 nextEvent; // ns
+        bool pendingAck; // host queued an acknowledged message
+    };
+
+    void handleMessage(const unsigned char *message);
+    void respond(unsigned char channel, unsigned char messageId, unsigned char code);
+    void queueMessage(unsigned char id, const unsigned char *data, int length);
+    void runChannels(qint64 now);
+    qint64 nextDeadline() const;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_dataReady;
+    QElapsedTimer m_clock;
+    QByteArray m_out;
+    QByteArray m_in; // partial frames from the host
+    Channel m_channels[VIRTUAL_STICK_CHANNELS];
+    bool m_present;
+    bool m_opened;
+};
+
+#endif // VIRTUALSTICK_H